@@ -0,0 +1,289 @@
+// Microbenchmark of the adaptive mean filter (the ROBOTICS post filter of libelas):
+// compares the original per-pixel SSE implementation with the row kernels of
+// filter::adaptiveMean() (SSE and, if supported, AVX) on the disparity maps of
+// datasets/profile, at full resolution and at half resolution (subsampling). The results are
+// bit-identical when both are compiled with -ffast-math, as by the make target and the serial
+// and OpenMP builds (see filter::detail::adaptive_mean_sse).
+//
+// build: make adaptive_mean_benchmark serial=1
+// run:   ./build/bin/adaptive_mean_benchmark [dataset directory] [repetitions]
+
+#include <emmintrin.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../src/common_includes/elas/filter.h"
+#include "../src/common_includes/image.h"
+
+typedef void (*kernel_fn)(const float *in, float *out, int32_t step, int32_t taps, int32_t n);
+
+// Elas::adaptiveMean() before the row kernels
+void adaptiveMeanLibelas(float *D, float *D_copy, float *D_tmp, int32_t D_width, int32_t D_height, bool subsampling) {
+    memcpy(D_copy, D, D_width * D_height * sizeof(float));
+
+    // zero input disparity maps to -10 (this makes the bilateral
+    // weights of all valid disparities to 0 in this region)
+    for (int32_t i = 0; i < D_width * D_height; i++) {
+        if (*(D + i) < 0)
+            *(D_copy + i) = -10;
+    }
+
+    // pixels the horizontal filter does not reach keep their input value
+    memcpy(D_tmp, D_copy, D_width * D_height * sizeof(float));
+
+    __m128 xconst0 = _mm_set1_ps(0);
+    __m128 xconst4 = _mm_set1_ps(4);
+    __m128 xval, xweight1, xweight2, xfactor1, xfactor2;
+
+    __attribute__((aligned(16))) float val[8];
+    __attribute__((aligned(16))) float weight[4];
+    __attribute__((aligned(16))) float factor[4];
+
+    // set absolute mask
+    __m128 xabsmask = _mm_set1_ps(0x7FFFFFFF);
+
+    // when doing subsampling: 4 pixel bilateral filter width
+    if (subsampling) {
+        // horizontal filter
+        for (int32_t v = 3; v < D_height - 3; v++) {
+            // init
+            for (int32_t u = 0; u < 3; u++)
+                val[u] = *(D_copy + v * D_width + u);
+
+            // loop
+            for (int32_t u = 3; u < D_width; u++) {
+                // set
+                float val_curr = *(D_copy + v * D_width + (u - 1));
+                val[u % 4] = *(D_copy + v * D_width + u);
+
+                xval = _mm_load_ps(val);
+                xweight1 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
+                xweight1 = _mm_and_ps(xweight1, xabsmask);
+                xweight1 = _mm_sub_ps(xconst4, xweight1);
+                xweight1 = _mm_max_ps(xconst0, xweight1);
+                xfactor1 = _mm_mul_ps(xval, xweight1);
+
+                _mm_store_ps(weight, xweight1);
+                _mm_store_ps(factor, xfactor1);
+
+                float weight_sum = weight[0] + weight[1] + weight[2] + weight[3];
+                float factor_sum = factor[0] + factor[1] + factor[2] + factor[3];
+
+                if (weight_sum > 0) {
+                    float d = factor_sum / weight_sum;
+                    if (d >= 0)
+                        *(D_tmp + v * D_width + (u - 1)) = d;
+                }
+            }
+        }
+
+        // vertical filter
+        for (int32_t u = 3; u < D_width - 3; u++) {
+            // init
+            for (int32_t v = 0; v < 3; v++)
+                val[v] = *(D_tmp + v * D_width + u);
+
+            // loop
+            for (int32_t v = 3; v < D_height; v++) {
+                // set
+                float val_curr = *(D_tmp + (v - 1) * D_width + u);
+                val[v % 4] = *(D_tmp + v * D_width + u);
+
+                xval = _mm_load_ps(val);
+                xweight1 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
+                xweight1 = _mm_and_ps(xweight1, xabsmask);
+                xweight1 = _mm_sub_ps(xconst4, xweight1);
+                xweight1 = _mm_max_ps(xconst0, xweight1);
+                xfactor1 = _mm_mul_ps(xval, xweight1);
+
+                _mm_store_ps(weight, xweight1);
+                _mm_store_ps(factor, xfactor1);
+
+                float weight_sum = weight[0] + weight[1] + weight[2] + weight[3];
+                float factor_sum = factor[0] + factor[1] + factor[2] + factor[3];
+
+                if (weight_sum > 0) {
+                    float d = factor_sum / weight_sum;
+                    if (d >= 0)
+                        *(D + (v - 1) * D_width + u) = d;
+                }
+            }
+        }
+
+        // full resolution: 8 pixel bilateral filter width
+    } else {
+        // horizontal filter
+        for (int32_t v = 3; v < D_height - 3; v++) {
+            // init
+            for (int32_t u = 0; u < 7; u++)
+                val[u] = *(D_copy + v * D_width + u);
+
+            // loop
+            for (int32_t u = 7; u < D_width; u++) {
+                // set
+                float val_curr = *(D_copy + v * D_width + (u - 3));
+                val[u % 8] = *(D_copy + v * D_width + u);
+
+                xval = _mm_load_ps(val);
+                xweight1 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
+                xweight1 = _mm_and_ps(xweight1, xabsmask);
+                xweight1 = _mm_sub_ps(xconst4, xweight1);
+                xweight1 = _mm_max_ps(xconst0, xweight1);
+                xfactor1 = _mm_mul_ps(xval, xweight1);
+
+                xval = _mm_load_ps(val + 4);
+                xweight2 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
+                xweight2 = _mm_and_ps(xweight2, xabsmask);
+                xweight2 = _mm_sub_ps(xconst4, xweight2);
+                xweight2 = _mm_max_ps(xconst0, xweight2);
+                xfactor2 = _mm_mul_ps(xval, xweight2);
+
+                xweight1 = _mm_add_ps(xweight1, xweight2);
+                xfactor1 = _mm_add_ps(xfactor1, xfactor2);
+
+                _mm_store_ps(weight, xweight1);
+                _mm_store_ps(factor, xfactor1);
+
+                float weight_sum = weight[0] + weight[1] + weight[2] + weight[3];
+                float factor_sum = factor[0] + factor[1] + factor[2] + factor[3];
+
+                if (weight_sum > 0) {
+                    float d = factor_sum / weight_sum;
+                    if (d >= 0)
+                        *(D_tmp + v * D_width + (u - 3)) = d;
+                }
+            }
+        }
+
+        // vertical filter
+        for (int32_t u = 3; u < D_width - 3; u++) {
+            // init
+            for (int32_t v = 0; v < 7; v++)
+                val[v] = *(D_tmp + v * D_width + u);
+
+            // loop
+            for (int32_t v = 7; v < D_height; v++) {
+                // set
+                float val_curr = *(D_tmp + (v - 3) * D_width + u);
+                val[v % 8] = *(D_tmp + v * D_width + u);
+
+                xval = _mm_load_ps(val);
+                xweight1 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
+                xweight1 = _mm_and_ps(xweight1, xabsmask);
+                xweight1 = _mm_sub_ps(xconst4, xweight1);
+                xweight1 = _mm_max_ps(xconst0, xweight1);
+                xfactor1 = _mm_mul_ps(xval, xweight1);
+
+                xval = _mm_load_ps(val + 4);
+                xweight2 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
+                xweight2 = _mm_and_ps(xweight2, xabsmask);
+                xweight2 = _mm_sub_ps(xconst4, xweight2);
+                xweight2 = _mm_max_ps(xconst0, xweight2);
+                xfactor2 = _mm_mul_ps(xval, xweight2);
+
+                xweight1 = _mm_add_ps(xweight1, xweight2);
+                xfactor1 = _mm_add_ps(xfactor1, xfactor2);
+
+                _mm_store_ps(weight, xweight1);
+                _mm_store_ps(factor, xfactor1);
+
+                float weight_sum = weight[0] + weight[1] + weight[2] + weight[3];
+                float factor_sum = factor[0] + factor[1] + factor[2] + factor[3];
+
+                if (weight_sum > 0) {
+                    float d = factor_sum / weight_sum;
+                    if (d >= 0)
+                        *(D + (v - 3) * D_width + u) = d;
+                }
+            }
+        }
+    }
+}
+
+
+// Elas::adaptiveMean() (serial build)
+void adaptiveMeanRows(float *D, float *D_copy, float *D_tmp, int32_t D_width, int32_t D_height, bool subsampling, kernel_fn kernel) {
+    int32_t taps = subsampling ? 4 : 8;
+    for (int32_t v = 0; v < D_height; v++) {
+        int32_t addr = v * D_width;
+        for (int32_t u = 0; u < D_width; u++) {
+            float d = *(D + addr + u);
+            *(D_copy + addr + u) = *(D_tmp + addr + u) = d < 0 ? -10 : d;
+        }
+        if (v >= 3 && v < D_height - 3)
+            kernel(D_copy + addr + taps / 2, D_tmp + addr + taps / 2, 1, taps, D_width - taps + 1);
+    }
+    for (int32_t v = taps / 2; v < D_height - taps / 2 + 1; v++) {
+        int32_t addr = v * D_width + 3;
+        kernel(D_tmp + addr, D + addr, D_width, taps, D_width - 6);
+    }
+}
+
+// best time of reps runs in ms, D is the filtered input afterwards
+template <typename F>
+double measure(F filter, const float *input, float *D, int32_t size, int32_t reps) {
+    double best = 1e30;
+    for (int32_t i = 0; i < reps; i++) {
+        memcpy(D, input, size * sizeof(float));
+        auto start = std::chrono::steady_clock::now();
+        filter(D);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    std::string dir = argc > 1 ? argv[1] : "datasets/profile";
+    int32_t reps = argc > 2 ? atoi(argv[2]) : 20;
+    const char *names[] = {"aloe", "cones", "raindeer", "urban1", "urban2", "urban3", "urban4"};
+    bool avx = false;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    avx = __builtin_cpu_supports("avx");
+#endif
+
+    printf("%-10s %-11s %10s %10s %10s %8s %12s\n", "image", "resolution", "libelas", "sse", "avx", "speedup", "max diff");
+    for (const char *name : names) {
+        image<uchar> *I = loadPGM((dir + "/" + name + "_left_disp.pgm").c_str());
+        for (int32_t subsampling = 0; subsampling < 2; subsampling++) {
+            // the disparity maps are stored with 0 as invalid value
+            int32_t w = I->width() / (subsampling + 1), h = I->height() / (subsampling + 1), size = w * h;
+            float *input = (float *)_mm_malloc(size * sizeof(float), 16);
+            float *D = (float *)_mm_malloc(size * sizeof(float), 16);
+            float *D_ref = (float *)_mm_malloc(size * sizeof(float), 16);
+            float *D_copy = (float *)_mm_malloc(size * sizeof(float), 16);
+            float *D_tmp = (float *)_mm_malloc(size * sizeof(float), 16);
+            for (int32_t v = 0; v < h; v++)
+                for (int32_t u = 0; u < w; u++) {
+                    uchar d = imRef(I, u * (subsampling + 1), v * (subsampling + 1));
+                    input[v * w + u] = d > 0 ? d : -1;
+                }
+
+            double t_old = measure([&](float *D) { adaptiveMeanLibelas(D, D_copy, D_tmp, w, h, subsampling); }, input, D_ref, size, reps);
+            double t_sse = measure([&](float *D) { adaptiveMeanRows(D, D_copy, D_tmp, w, h, subsampling, filter::detail::adaptive_mean_sse); }, input, D, size, reps);
+            double t_avx = 0;
+            if (avx)
+                t_avx = measure([&](float *D) { adaptiveMeanRows(D, D_copy, D_tmp, w, h, subsampling, filter::detail::adaptive_mean_avx); }, input, D, size, reps);
+            float max_diff = 0;
+            for (int32_t i = 0; i < size; i++)
+                max_diff = std::max(max_diff, fabsf(D[i] - D_ref[i]));
+
+            char resolution[32];
+            snprintf(resolution, sizeof(resolution), "%dx%d", w, h);
+            printf("%-10s %-11s %8.2fms %8.2fms %8.2fms %7.1fx %12g\n", name, resolution, t_old, t_sse, t_avx, t_old / (avx ? t_avx : t_sse), max_diff);
+
+            _mm_free(input);
+            _mm_free(D);
+            _mm_free(D_ref);
+            _mm_free(D_copy);
+            _mm_free(D_tmp);
+        }
+        delete I;
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,266 @@
+#include "delaunay.h"
+
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+void Delaunay::triangulate(const int32_t *u, const int32_t *v, int32_t n) {
+    this->u = u;
+    this->v = v;
+    reserve(n);
+    triangles.clear();
+    halfedges.clear();
+    if (n < 3)
+        return;
+
+    // center of the bounding box (doubled to stay integer)
+    int32_t u_min = u[0], u_max = u[0], v_min = v[0], v_max = v[0];
+    for (int32_t i = 1; i < n; i++) {
+        u_min = min(u_min, u[i]);
+        u_max = max(u_max, u[i]);
+        v_min = min(v_min, v[i]);
+        v_max = max(v_max, v[i]);
+    }
+    int32_t cu2 = u_min + u_max, cv2 = v_min + v_max;
+    cu = 0.5f * cu2;
+    cv = 0.5f * cv2;
+
+    // sweep order: by distance to the center, packed with the point index (24 bits) into one key
+    keys.resize(n);
+    for (int32_t i = 0; i < n; i++) {
+        int64_t du = 2 * u[i] - cu2, dv = 2 * v[i] - cv2;
+        keys[i] = (uint64_t)(du * du + dv * dv) << 24 | i;
+    }
+    sort(keys.begin(), keys.end());
+
+    // duplicates are at the same distance, they are left out
+    order.resize(n);
+    int32_t m = 0;
+    for (int32_t i = 0; i < n; i++) {
+        int32_t p = keys[i] & 0xFFFFFF, j = i - 1;
+        while (j >= 0 && keys[j] >> 24 == keys[i] >> 24 && (u[keys[j] & 0xFFFFFF] != u[p] || v[keys[j] & 0xFFFFFF] != v[p]))
+            j--;
+        if (j < 0 || keys[j] >> 24 != keys[i] >> 24)
+            order[m++] = p;
+    }
+
+    // the first points may be collinear (e.g. center and its lattice neighbors), they are
+    // connected to the first point off their line by a fan of triangles
+    int32_t k = 2;
+    while (k < m && orient(order[0], order[1], order[k]) == 0)
+        k++;
+    if (k >= m)
+        return;
+    sort(order.begin(), order.begin() + k, [u, v](int32_t a, int32_t b) { return u[a] < u[b] || (u[a] == u[b] && v[a] < v[b]); });
+    int32_t p = order[k];
+    bool ccw = orient(order[0], order[1], p) > 0;
+    for (int32_t j = 0; j + 1 < k; j++) {
+        int32_t a = ccw ? order[j] : order[j + 1];
+        int32_t b = ccw ? order[j + 1] : order[j];
+        int32_t t = addTriangle(a, b, p, -1, -1, -1);
+        if (j > 0)
+            link(ccw ? t + 2 : t + 1, ccw ? t - 2 : t - 1);
+    }
+
+    // convex hull of the fan
+    hull_hash.assign((int32_t)ceil(sqrt((float)m)), -1);
+    for (int32_t e = 0; e < (int32_t)halfedges.size(); e++) {
+        if (halfedges[e] >= 0)
+            continue;
+        int32_t a = triangles[e], b = triangles[e % 3 == 2 ? e - 2 : e + 1];
+        hull_next[a] = b;
+        hull_prev[b] = a;
+        hull_tri[a] = e;
+        hull_hash[hashKey(a)] = a;
+    }
+
+    // sweep: every point lies outside of the triangulation of the points closer to the center
+    for (int32_t i = k + 1; i < m; i++)
+        insert(order[i]);
+
+}
+
+void Delaunay::reserve(int32_t n) {
+    reserveVector(triangles, 6 * n);
+    reserveVector(halfedges, 6 * n);
+    reserveVector(hull_next, n);
+    reserveVector(hull_prev, n);
+    reserveVector(hull_tri, n);
+    reserveVector(keys, n);
+    reserveVector(order, n);
+    reserveVector(edge_stack, n);
+    reserveVector(star, n);
+    reserveVector(hull_hash, (int32_t)ceil(sqrt((float)n)));
+    hull_next.resize(n);
+    hull_prev.resize(n);
+    hull_tri.resize(n);
+}
+
+template <typename T>
+void Delaunay::reserveVector(vector<T> &vec, int32_t n) {
+    if (vec.capacity() < (size_t)n) {
+        allocations++;
+        vec.reserve(n);
+    }
+}
+
+int32_t Delaunay::addTriangle(int32_t i0, int32_t i1, int32_t i2, int32_t a, int32_t b, int32_t c) {
+    int32_t t = triangles.size();
+    triangles.push_back(i0);
+    triangles.push_back(i1);
+    triangles.push_back(i2);
+    halfedges.push_back(-1);
+    halfedges.push_back(-1);
+    halfedges.push_back(-1);
+    link(t, a);
+    link(t + 1, b);
+    link(t + 2, c);
+    return t;
+}
+
+void Delaunay::link(int32_t a, int32_t b) {
+    if (a >= 0)
+        halfedges[a] = b;
+    if (b >= 0)
+        halfedges[b] = a;
+}
+
+int32_t Delaunay::hashKey(int32_t p) const {
+    // pseudo angle of p around the center, monotone in the true angle
+    float du = u[p] - cu, dv = v[p] - cv;
+    float d = fabs(du) + fabs(dv);
+    float angle = d > 0 ? (dv > 0 ? 3 - du / d : 1 + du / d) / 4 : 0;
+    int32_t size = hull_hash.size();
+    return min((int32_t)(angle * size), size - 1);
+}
+
+void Delaunay::insert(int32_t p) {
+    // start at a hull vertex of about the same angle as p, then walk along the hull to the
+    // first edge visible from p (p strictly on its right)
+    int32_t size = hull_hash.size(), key = hashKey(p), s = -1;
+    for (int32_t j = 0; j < size; j++) {
+        s = hull_hash[(key + j) % size];
+        if (s >= 0 && hull_next[s] != s)
+            break;
+    }
+    s = hull_prev[s];
+    while (orient(s, hull_next[s], p) >= 0)
+        s = hull_next[s];
+
+    // the visible edges form a chain from s to t
+    int32_t t = hull_next[s];
+    while (orient(hull_prev[s], s, p) < 0)
+        s = hull_prev[s];
+    while (orient(t, hull_next[t], p) < 0)
+        t = hull_next[t];
+
+    // connect p to the visible edges
+    star.clear();
+    int32_t t_first = triangles.size(), e_prev = -1;
+    for (int32_t a = s; a != t; a = hull_next[a]) {
+        int32_t tri = addTriangle(a, p, hull_next[a], e_prev, -1, hull_tri[a]);
+        e_prev = tri + 1;
+        star.push_back(tri + 1);
+    }
+    int32_t t_last = triangles.size();
+
+    // update the hull (vertices removed from it point to themselves)
+    for (int32_t a = hull_next[s]; a != t;) {
+        int32_t a_next = hull_next[a];
+        hull_next[a] = a;
+        a = a_next;
+    }
+    hull_next[s] = p;
+    hull_prev[p] = s;
+    hull_next[p] = t;
+    hull_prev[t] = p;
+    hull_tri[s] = t_first;
+    hull_hash[hashKey(p)] = p;
+    hull_hash[hashKey(s)] = s;
+
+    // restore the Delaunay property by flipping the old edges opposite of p
+    for (int32_t tri = t_first; tri < t_last; tri += 3)
+        legalize(tri + 2);
+
+    // the hull edge leaving p may have moved to another triangle
+    for (int32_t i = 0; i < (int32_t)star.size(); i++) {
+        if (halfedges[star[i]] < 0) {
+            hull_tri[p] = star[i];
+            break;
+        }
+    }
+}
+
+bool Delaunay::fatterFlipped(int32_t p0, int32_t pr, int32_t pl, int32_t p1) const {
+    // compares the smallest angles of both triangles before (p0, pr, pl and pr, p1, pl) and after
+    // flipping (p0, pr, p1 and p0, p1, pl), the smaller one first
+    int64_t dot[4], cross[4];
+    minAngle(p0, pr, pl, dot[0], cross[0]);
+    minAngle(pr, p1, pl, dot[1], cross[1]);
+    minAngle(p0, pr, p1, dot[2], cross[2]);
+    minAngle(p0, p1, pl, dot[3], cross[3]);
+    auto smaller = [&dot, &cross](int32_t i, int32_t j) { return dot[i] * cross[j] > dot[j] * cross[i]; };
+    int32_t before_lo = smaller(1, 0) ? 1 : 0, after_lo = smaller(3, 2) ? 3 : 2;
+    if (smaller(before_lo, after_lo))
+        return true;
+    if (smaller(after_lo, before_lo))
+        return false;
+    return smaller(1 - before_lo, 5 - after_lo);
+}
+
+void Delaunay::legalize(int32_t a) {
+    // checks the edge a opposite of the new point p0 against the point p1 on its other side,
+    // flipping it if p1 lies inside of the circumcircle of p0, pr, pl (then continues with the two
+    // edges opposite of p0 in the flipped triangles); if all four points are on one circle (which
+    // is frequent on the lattice) both diagonals are Delaunay and the one giving the larger
+    // smallest angles is kept
+    /*
+     *            pl                    pl
+     *           /||\                  /  \
+     *        al/ || \bl            al/    \a
+     *         /  ||  \              /      \
+     *        /  a||b  \    flip    /___ar___\
+     *      p0\   ||   /p1   =>   p0\---bl---/p1
+     *         \  ||  /              \      /
+     *        ar\ || /br             b\    /br
+     *           \||/                  \  /
+     *            pr                    pr
+     */
+    edge_stack.clear();
+    while (true) {
+        int32_t b = halfedges[a];
+        int32_t a0 = a - a % 3;
+        int32_t ar = a0 + (a + 2) % 3;
+        if (b >= 0) {
+            int32_t b0 = b - b % 3;
+            int32_t al = a0 + (a + 1) % 3;
+            int32_t bl = b0 + (b + 2) % 3;
+            int32_t p0 = triangles[ar];
+            int32_t pr = triangles[a];
+            int32_t pl = triangles[al];
+            int32_t p1 = triangles[bl];
+            int64_t in_circle = inCircle(p0, pr, pl, p1);
+            if (in_circle > 0 || (in_circle == 0 && fatterFlipped(p0, pr, pl, p1))) {
+                triangles[a] = p1;
+                triangles[b] = p0;
+
+                // the hull edge bl is replaced by a
+                int32_t hbl = halfedges[bl];
+                if (hbl < 0 && hull_tri[p1] == bl)
+                    hull_tri[p1] = a;
+
+                link(a, hbl);
+                link(b, halfedges[ar]);
+                link(ar, bl);
+                star.push_back(b);
+                edge_stack.push_back(b0 + (b + 1) % 3);
+                continue;
+            }
+        }
+        if (edge_stack.empty())
+            break;
+        a = edge_stack.back();
+        edge_stack.pop_back();
+    }
+}
\ No newline at end of file
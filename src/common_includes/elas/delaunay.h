@@ -0,0 +1,106 @@
+// Delaunay triangulation of the support points of libelas. It replaces the
+// general purpose triangulator of triangle.cpp and exploits that the support
+// points lie on the candidate lattice (shifted by integer disparities in the
+// right image): all coordinates are small integers, hence the geometric
+// predicates and the sweep order are exact in 64 bit integer arithmetic and no
+// robustness machinery is needed. The points are inserted in order of their
+// distance to the center of the lattice (a column by column sweep would connect
+// every new column to a long fan of the previous one and flip it over and over),
+// the convex hull is found through a hash over the angle around the center.
+
+#ifndef __DELAUNAY_H__
+#define __DELAUNAY_H__
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+// define fixed-width datatypes for Visual Studio projects
+#ifndef _MSC_VER
+#include <stdint.h>
+#else
+typedef __int8 int8_t;
+typedef __int16 int16_t;
+typedef __int32 int32_t;
+typedef __int64 int64_t;
+typedef unsigned __int8 uint8_t;
+typedef unsigned __int16 uint16_t;
+typedef unsigned __int32 uint32_t;
+typedef unsigned __int64 uint64_t;
+#endif
+
+class Delaunay {
+   public:
+    Delaunay() : allocations(0), u(0), v(0) {}
+
+    // triangulates the points (u[i], v[i]), i = 0..n-1: every point except for duplicates becomes a
+    // vertex, the triangles are stored as vertex index triplets (counter-clockwise in u/v) in triangles
+    void triangulate(const int32_t *u, const int32_t *v, int32_t n);
+
+    // makes room for n points, such that triangulate() does not allocate for up to n points
+    void reserve(int32_t n);
+
+    // resulting triangles, 3 vertex indices each
+    std::vector<int32_t> triangles;
+
+    // number of heap allocations done by this triangulator so far
+    uint64_t allocations;
+
+   private:
+    const int32_t *u, *v;
+
+    // half edge e runs from vertex triangles[e] to the next vertex of its triangle,
+    // halfedges[e] is the opposite half edge in the neighboring triangle (-1: convex hull)
+    std::vector<int32_t> halfedges;
+
+    // convex hull as doubly linked list of vertices (counter-clockwise), hull_tri[i] is
+    // the half edge from vertex i to hull_next[i]
+    std::vector<int32_t> hull_next, hull_prev, hull_tri;
+
+    // sort keys (squared distance to the center and point index), sweep order, edges to
+    // legalize and the half edges leaving the point being inserted
+    std::vector<uint64_t> keys;
+    std::vector<int32_t> order, edge_stack, star;
+
+    // hull vertices by angle around the center (cu, cv) of the points
+    std::vector<int32_t> hull_hash;
+    float cu, cv;
+
+    template <typename T>
+    void reserveVector(std::vector<T> &vec, int32_t n);
+
+    int32_t addTriangle(int32_t i0, int32_t i1, int32_t i2, int32_t a, int32_t b, int32_t c);
+    void link(int32_t a, int32_t b);
+    int32_t hashKey(int32_t p) const;
+    void insert(int32_t p);
+    void legalize(int32_t a);
+    bool fatterFlipped(int32_t p0, int32_t pr, int32_t pl, int32_t p1) const;
+
+    // > 0 if a, b, c are counter-clockwise, 0 if they are collinear
+    inline int64_t orient(int32_t a, int32_t b, int32_t c) const {
+        return (int64_t)(u[b] - u[a]) * (v[c] - v[a]) - (int64_t)(v[b] - v[a]) * (u[c] - u[a]);
+    }
+
+    // > 0 if d is inside of the circumcircle of the counter-clockwise triangle a, b, c, 0 if on it
+    inline int64_t inCircle(int32_t a, int32_t b, int32_t c, int32_t d) const {
+        int64_t adx = u[a] - u[d], ady = v[a] - v[d];
+        int64_t bdx = u[b] - u[d], bdy = v[b] - v[d];
+        int64_t cdx = u[c] - u[d], cdy = v[c] - v[d];
+        int64_t alift = adx * adx + ady * ady;
+        int64_t blift = bdx * bdx + bdy * bdy;
+        int64_t clift = cdx * cdx + cdy * cdy;
+        return alift * (bdx * cdy - cdx * bdy) + blift * (cdx * ady - adx * cdy) + clift * (adx * bdy - bdx * ady);
+    }
+
+    // smallest angle of triangle a, b, c as cot = dot / cross, which is exact in integers and
+    // decreasing in the angle
+    inline void minAngle(int32_t a, int32_t b, int32_t c, int64_t &dot, int64_t &cross) const {
+        int64_t dot_a = (int64_t)(u[b] - u[a]) * (u[c] - u[a]) + (int64_t)(v[b] - v[a]) * (v[c] - v[a]);
+        int64_t dot_b = (int64_t)(u[c] - u[b]) * (u[a] - u[b]) + (int64_t)(v[c] - v[b]) * (v[a] - v[b]);
+        int64_t dot_c = (int64_t)(u[a] - u[c]) * (u[b] - u[c]) + (int64_t)(v[a] - v[c]) * (v[b] - v[c]);
+        dot = std::max(dot_a, std::max(dot_b, dot_c));
+        cross = std::abs(orient(a, b, c));
+    }
+};
+
+#endif
\ No newline at end of file
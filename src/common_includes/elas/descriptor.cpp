@@ -22,105 +22,136 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 #include "descriptor.h"
 
 #include <emmintrin.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "filter.h"
 
 using namespace std;
 
-Descriptor::Descriptor(uint8_t *I, int32_t width, int32_t height, int32_t bpl, bool half_resolution) {
-    I_desc = (uint8_t *)_mm_malloc(16 * width * height * sizeof(uint8_t), 16);
-    uint8_t *I_du = (uint8_t *)_mm_malloc(bpl * height * sizeof(uint8_t), 16);
-    uint8_t *I_dv = (uint8_t *)_mm_malloc(bpl * height * sizeof(uint8_t), 16);
-    filter::sobel3x3(I, I_du, I_dv, bpl, height);
-    // Create 16 byte discriptors for each deep image pixel
-    createDescriptor(I_du, I_dv, width, height, bpl, half_resolution);
-    _mm_free(I_du);
-    _mm_free(I_dv);
+Descriptor::Descriptor(const uint8_t *I, int32_t width, int32_t height, int32_t stride, bool half_resolution) : Descriptor() {
+    compute(I, width, height, stride, half_resolution);
 }
 
 Descriptor::~Descriptor() {
+    release();
+}
+
+void Descriptor::compute(const uint8_t *I, int32_t width, int32_t height, int32_t stride, bool half_resolution, bool packed) {
+#ifdef _OPENMP
+    int32_t slots = omp_get_num_threads();
+#else
+    int32_t slots = 1;
+#endif
+    packed = packed && half_resolution;
+    if (I_desc == 0 || this->width != width || this->height != height || this->packed != packed || band_slots < slots)
+        allocate(width, height, packed, slots);
+
+    // Create 16 byte discriptors for each deep image pixel of the rows 3 to height - 4 (every second
+    // row from 4 on for half resolution). A band of descriptors reads du and dv of its rows and the two
+    // rows above and below, which are filtered from the image rows v_min - 3 to v_max + 2 (the first
+    // and last filtered row are incomplete). The bands are independent, OpenMP builds split them into
+    // tasks.
+    int32_t num_bands = (height - 6 + band - 1) / band;
+#ifdef _OPENMP
+#pragma omp taskloop
+#endif
+    for (int32_t b = 0; b < num_bands; b++) {
+        int32_t v_min = 3 + b * band;
+        int32_t v_max = min(v_min + band, height - 3);
+        int32_t rows = v_max - v_min + 6;
+#ifdef _OPENMP
+        uint8_t *slot = I_band + omp_get_thread_num() * 7 * (band + 6) * bpl;
+#else
+        uint8_t *slot = I_band;
+#endif
+        uint8_t *I_rows = slot;
+        uint8_t *I_du = I_rows + rows * bpl;
+        uint8_t *I_dv = I_du + rows * bpl;
+        int16_t *I_du_tmp = (int16_t *)(I_dv + rows * bpl);
+        int16_t *I_dv_tmp = I_du_tmp + rows * bpl;
+
+        // copy the image rows to byte aligned memory (the padding bytes only reach sobel responses
+        // no descriptor reads)
+        for (int32_t v = 0; v < rows; v++)
+            memcpy(I_rows + v * bpl, I + (v_min - 3 + v) * stride, width * sizeof(uint8_t));
+        filter::sobel3x3(I_rows, I_du, I_dv, I_du_tmp, I_dv_tmp, bpl, rows);
+
+        for (int32_t v = v_min; v < v_max; v++)
+            if (!half_resolution || (v >= 4 && v % 2 == 0))
+                createDescriptorRow(I_du - (v_min - 3) * bpl, I_dv - (v_min - 3) * bpl, v, I_desc + 16 * width * (packed ? v / 2 : v));
+    }
+}
+
+void Descriptor::allocate(int32_t width, int32_t height, bool packed, int32_t slots) {
+    release();
+    this->width = width;
+    this->height = height;
+    this->bpl = width + 15 - (width - 1) % 16;
+    this->packed = packed;
+    band_slots = slots;
+    int32_t desc_height = packed ? (height + 1) / 2 : height;
+    I_desc = (uint8_t *)_mm_malloc(16 * width * desc_height * sizeof(uint8_t), 16);
+    I_band = (uint8_t *)_mm_malloc(slots * 7 * (band + 6) * bpl * sizeof(uint8_t), 16);
+    allocations += 2;
+
+    // the border of I_desc is never written by createDescriptorRow() but read
+    // by the matcher, so it has to be in a defined state (as well as the
+    // incomplete first and last row of a band and the padding, which are never used)
+    memset(I_desc, 0, 16 * width * desc_height * sizeof(uint8_t));
+    memset(I_band, 0, slots * 7 * (band + 6) * bpl * sizeof(uint8_t));
+}
+
+void Descriptor::release() {
     _mm_free(I_desc);
+    _mm_free(I_band);
+    I_desc = I_band = 0;
+    band_slots = 0;
 }
 
-void Descriptor::createDescriptor(uint8_t *I_du, uint8_t *I_dv, int32_t width, int32_t height, int32_t bpl, bool half_resolution) {
+void Descriptor::createDescriptorRow(const uint8_t *I_du, const uint8_t *I_dv, int32_t v, uint8_t *I_desc_row) {
     uint8_t *I_desc_curr;
     uint32_t addr_v0, addr_v1, addr_v2, addr_v3, addr_v4;
 
-    // Do not compute every second line
-    if (half_resolution) {
-        // Create filter strip
-        for (int32_t v = 4; v < height - 3; v += 2) {
-            addr_v2 = v * bpl;            // Current line
-            addr_v0 = addr_v2 - 2 * bpl;  // 2 lines above
-            addr_v1 = addr_v2 - 1 * bpl;  // 1 lines above
-            addr_v3 = addr_v2 + 1 * bpl;  // 1 lines below
-            addr_v4 = addr_v2 + 2 * bpl;  // 2 lines below
-
-            // Save the surrounding filtered rhombus point of interests (Total
-            // of 16 points) Du is horizontal filter result Dv is vertical
-            // filter result (more horizontal change in stereo camera so we can
-            // use less vertical stuff) du :
-            //  - - x - -
-            //  - x x x -
-            //  x x o x x
-            //  - x x x -
-            //  - - x - -
-            // dv :
-            //  - - - - -
-            //  - - x - -
-            //  - x o x -
-            //  - - x - -
-            //  - - - - -
-            for (int32_t u = 3; u < width - 3; u++) {
-                I_desc_curr = I_desc + (v * width + u) * 16;
-                *(I_desc_curr++) = *(I_du + addr_v0 + u + 0);
-                *(I_desc_curr++) = *(I_du + addr_v1 + u - 2);
-                *(I_desc_curr++) = *(I_du + addr_v1 + u + 0);
-                *(I_desc_curr++) = *(I_du + addr_v1 + u + 2);
-                *(I_desc_curr++) = *(I_du + addr_v2 + u - 1);
-                *(I_desc_curr++) = *(I_du + addr_v2 + u + 0);
-                *(I_desc_curr++) = *(I_du + addr_v2 + u + 0);
-                *(I_desc_curr++) = *(I_du + addr_v2 + u + 1);
-                *(I_desc_curr++) = *(I_du + addr_v3 + u - 2);
-                *(I_desc_curr++) = *(I_du + addr_v3 + u + 0);
-                *(I_desc_curr++) = *(I_du + addr_v3 + u + 2);
-                *(I_desc_curr++) = *(I_du + addr_v4 + u + 0);
-                *(I_desc_curr++) = *(I_dv + addr_v1 + u + 0);
-                *(I_desc_curr++) = *(I_dv + addr_v2 + u - 1);
-                *(I_desc_curr++) = *(I_dv + addr_v2 + u + 1);
-                *(I_desc_curr++) = *(I_dv + addr_v3 + u + 0);
-            }
-        }
-
-        // Compute full descriptor images
-    } else {
-        // Create filter strip
-        for (int32_t v = 3; v < height - 3; v++) {
-            addr_v2 = v * bpl;
-            addr_v0 = addr_v2 - 2 * bpl;
-            addr_v1 = addr_v2 - 1 * bpl;
-            addr_v3 = addr_v2 + 1 * bpl;
-            addr_v4 = addr_v2 + 2 * bpl;
-
-            for (int32_t u = 3; u < width - 3; u++) {
-                I_desc_curr = I_desc + (v * width + u) * 16;
-                *(I_desc_curr++) = *(I_du + addr_v0 + u + 0);
-                *(I_desc_curr++) = *(I_du + addr_v1 + u - 2);
-                *(I_desc_curr++) = *(I_du + addr_v1 + u + 0);
-                *(I_desc_curr++) = *(I_du + addr_v1 + u + 2);
-                *(I_desc_curr++) = *(I_du + addr_v2 + u - 1);
-                *(I_desc_curr++) = *(I_du + addr_v2 + u + 0);
-                *(I_desc_curr++) = *(I_du + addr_v2 + u + 0);
-                *(I_desc_curr++) = *(I_du + addr_v2 + u + 1);
-                *(I_desc_curr++) = *(I_du + addr_v3 + u - 2);
-                *(I_desc_curr++) = *(I_du + addr_v3 + u + 0);
-                *(I_desc_curr++) = *(I_du + addr_v3 + u + 2);
-                *(I_desc_curr++) = *(I_du + addr_v4 + u + 0);
-                *(I_desc_curr++) = *(I_dv + addr_v1 + u + 0);
-                *(I_desc_curr++) = *(I_dv + addr_v2 + u - 1);
-                *(I_desc_curr++) = *(I_dv + addr_v2 + u + 1);
-                *(I_desc_curr++) = *(I_dv + addr_v3 + u + 0);
-            }
-        }
+    addr_v2 = v * bpl;            // Current line
+    addr_v0 = addr_v2 - 2 * bpl;  // 2 lines above
+    addr_v1 = addr_v2 - 1 * bpl;  // 1 lines above
+    addr_v3 = addr_v2 + 1 * bpl;  // 1 lines below
+    addr_v4 = addr_v2 + 2 * bpl;  // 2 lines below
+
+    // Save the surrounding filtered rhombus point of interests (Total
+    // of 16 points) Du is horizontal filter result Dv is vertical
+    // filter result (more horizontal change in stereo camera so we can
+    // use less vertical stuff) du :
+    //  - - x - -
+    //  - x x x -
+    //  x x o x x
+    //  - x x x -
+    //  - - x - -
+    // dv :
+    //  - - - - -
+    //  - - x - -
+    //  - x o x -
+    //  - - x - -
+    //  - - - - -
+    for (int32_t u = 3; u < width - 3; u++) {
+        I_desc_curr = I_desc_row + u * 16;
+        *(I_desc_curr++) = *(I_du + addr_v0 + u + 0);
+        *(I_desc_curr++) = *(I_du + addr_v1 + u - 2);
+        *(I_desc_curr++) = *(I_du + addr_v1 + u + 0);
+        *(I_desc_curr++) = *(I_du + addr_v1 + u + 2);
+        *(I_desc_curr++) = *(I_du + addr_v2 + u - 1);
+        *(I_desc_curr++) = *(I_du + addr_v2 + u + 0);
+        *(I_desc_curr++) = *(I_du + addr_v2 + u + 0);
+        *(I_desc_curr++) = *(I_du + addr_v2 + u + 1);
+        *(I_desc_curr++) = *(I_du + addr_v3 + u - 2);
+        *(I_desc_curr++) = *(I_du + addr_v3 + u + 0);
+        *(I_desc_curr++) = *(I_du + addr_v3 + u + 2);
+        *(I_desc_curr++) = *(I_du + addr_v4 + u + 0);
+        *(I_desc_curr++) = *(I_dv + addr_v1 + u + 0);
+        *(I_desc_curr++) = *(I_dv + addr_v2 + u - 1);
+        *(I_desc_curr++) = *(I_dv + addr_v2 + u + 1);
+        *(I_desc_curr++) = *(I_dv + addr_v3 + u + 0);
     }
-}
\ No newline at end of file
+}
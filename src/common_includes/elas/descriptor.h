@@ -50,18 +50,41 @@ typedef unsigned __int64 uint64_t;
 class Descriptor {
    public:
     // constructor creates filters
-    Descriptor() {}
-    Descriptor(uint8_t *I, int32_t width, int32_t height, int32_t bpl, bool half_resolution);
+    Descriptor() : I_desc(0), allocations(0), I_band(0), band_slots(0), width(0), height(0), bpl(0), packed(false) {}
+    Descriptor(const uint8_t *I, int32_t width, int32_t height, int32_t stride, bool half_resolution);
 
     // deconstructor releases memory
     ~Descriptor();
 
+    // (re)computes the descriptors of image I (stride: bytes per line of I, any
+    // alignment); all buffers are kept between calls and only reallocated if
+    // the size or the layout change. packed (half resolution only): I_desc
+    // holds just the computed even rows, row v at I_desc + 16 * width * (v / 2)
+    void compute(const uint8_t *I, int32_t width, int32_t height, int32_t stride, bool half_resolution, bool packed = false);
+
     // descriptors accessible from outside
     uint8_t *I_desc;
 
+    // number of heap allocations done by this descriptor so far
+    uint64_t allocations;
+
    private:
-    // build descriptor I_desc from I_du and I_dv
-    void createDescriptor(uint8_t *I_du, uint8_t *I_dv, int32_t width, int32_t height, int32_t bpl, bool half_resolution);
+    // the sobel responses are computed for bands of band rows of descriptors at a time (plus the
+    // rows the descriptors and the filter read above and below) and turned into descriptors right
+    // away, every thread has a slot of I_band holding the 16 byte aligned image rows, du, dv and
+    // their 16 bit intermediate results
+    static const int32_t band = 32;
+    uint8_t *I_band;
+    int32_t band_slots;
+    int32_t width, height, bpl;
+    bool packed;
+
+    // (re)allocate all buffers for the given image size, layout and number of threads
+    void allocate(int32_t width, int32_t height, bool packed, int32_t slots);
+    void release();
+
+    // build the descriptors of row v from I_du and I_dv (addressed like images) into I_desc_row
+    void createDescriptorRow(const uint8_t *I_du, const uint8_t *I_dv, int32_t v, uint8_t *I_desc_row);
 };
 
 #endif
\ No newline at end of file
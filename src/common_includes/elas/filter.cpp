@@ -40,6 +40,22 @@ typedef unsigned __int32 uint32_t;
 typedef unsigned __int64 uint64_t;
 #endif
 
+// the AVX kernels are compiled with function level target attributes and selected at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILTER_AVX
+#include <immintrin.h>
+#endif
+
+// with -ffast-math GCC replaces vector divisions by a reciprocal approximation, the adaptive
+// mean filter has always divided exactly
+#if defined(__GNUC__) && !defined(__clang__)
+#define EXACT_DIV_PS(a, b) __builtin_ia32_divps(a, b)
+#define EXACT_DIV_PS256(a, b) __builtin_ia32_divps256(a, b)
+#else
+#define EXACT_DIV_PS(a, b) _mm_div_ps(a, b)
+#define EXACT_DIV_PS256(a, b) _mm256_div_ps(a, b)
+#endif
+
 // fast filters: implements 3x3 and 5x5 sobel filters and
 //               5x5 blob and corner filters based on SSE2/3 instructions
 namespace filter {
@@ -416,11 +432,15 @@ namespace filter {
     void sobel3x3(const uint8_t *in, uint8_t *out_v, uint8_t *out_h, int w, int h) {
         int16_t *temp_h = (int16_t *)(_mm_malloc(w * h * sizeof(int16_t), 16));
         int16_t *temp_v = (int16_t *)(_mm_malloc(w * h * sizeof(int16_t), 16));
+        sobel3x3(in, out_v, out_h, temp_v, temp_h, w, h);
+        _mm_free(temp_h);
+        _mm_free(temp_v);
+    }
+
+    void sobel3x3(const uint8_t *in, uint8_t *out_v, uint8_t *out_h, int16_t *temp_v, int16_t *temp_h, int w, int h) {
         detail::convolve_cols_3x3(in, temp_v, temp_h, w, h);
         detail::convolve_101_row_3x3_16bit(temp_v, out_v, w, h);
         detail::convolve_121_row_3x3_16bit(temp_h, out_h, w, h);
-        _mm_free(temp_h);
-        _mm_free(temp_v);
     }
 
     void sobel5x5(const uint8_t *in, uint8_t *out_v, uint8_t *out_h, int w, int h) {
@@ -473,4 +493,236 @@ namespace filter {
         }
         _mm_free(integral);
     }
+
+    // compare and swap of the median network, a becomes the smaller value
+    static inline void sort2(__m128 &a, __m128 &b) {
+        __m128 t = a;
+        a = _mm_min_ps(t, b);
+        b = _mm_max_ps(t, b);
+    }
+    static inline void sort2(float &a, float &b) {
+        float t = a;
+        a = t < b ? t : b;
+        b = t < b ? b : t;
+    }
+
+    // sorting network of 7 values (16 comparators), the comparators which do not lead to the
+    // median are removed by the compiler
+    template <typename T>
+    static inline T median7(T *x) {
+        sort2(x[0], x[6]), sort2(x[2], x[3]), sort2(x[4], x[5]);
+        sort2(x[0], x[2]), sort2(x[1], x[4]), sort2(x[3], x[6]);
+        sort2(x[0], x[1]), sort2(x[2], x[5]), sort2(x[3], x[4]);
+        sort2(x[1], x[2]), sort2(x[4], x[6]);
+        sort2(x[2], x[3]), sort2(x[4], x[5]);
+        sort2(x[1], x[2]), sort2(x[3], x[4]), sort2(x[5], x[6]);
+        return x[3];
+    }
+
+    void median7(const float *in, const float *center, float *out, int32_t step, int32_t n) {
+        int32_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128 x[7];
+            for (int32_t k = 0; k < 7; k++)
+                x[k] = _mm_loadu_ps(in + i + (k - 3) * step);
+            __m128 med = median7(x);
+            __m128 c = _mm_loadu_ps(center + i);
+            __m128 valid = _mm_cmpge_ps(c, _mm_setzero_ps());
+            _mm_storeu_ps(out + i, _mm_or_ps(_mm_and_ps(valid, med), _mm_andnot_ps(valid, c)));
+        }
+        for (; i < n; i++) {
+            float x[7];
+            for (int32_t k = 0; k < 7; k++)
+                x[k] = in[i + (k - 3) * step];
+            out[i] = center[i] >= 0 ? median7(x) : center[i];
+        }
+    }
+
+    namespace detail {
+        // keeps -ffast-math from reassociating the sums of the adaptive mean filter
+#ifdef __GNUC__
+        static inline __m128 ordered(__m128 x) {
+            __asm__("" : "+x"(x));
+            return x;
+        }
+#else
+        static inline __m128 ordered(__m128 x) {
+            return x;
+        }
+#endif
+#ifdef FILTER_AVX
+        __attribute__((target("avx"))) static inline __m256 ordered(__m256 x) {
+            __asm__("" : "+x"(x));
+            return x;
+        }
+#endif
+
+        // The weights are max(0, 4 - (|x - center| & mask)) where mask is the float 0x7FFFFFFF
+        // (not the bit pattern) as in the original libelas filter, which also clears the mantissa
+        // of the difference. Hence the weights jump with the last bit of the difference and the
+        // sums are formed as in the original: taps k and k+4 are added first (8 pixel filter),
+        // then the resulting 4 values (in ring buffer order, which is a rotation of the taps) are
+        // reduced as (0 + 2) + (1 + 3), which gives the same for every rotation. The original
+        // adds the 4 values from left to right, which GCC reassociates to this order with
+        // -ffast-math only, so the results equal the original in the -ffast-math builds (serial
+        // and OpenMP) and may differ in the last bit without it.
+        void adaptive_mean_sse(const float *in, float *out, int32_t step, int32_t taps, int32_t n) {
+            const __m128 xconst0 = _mm_set1_ps(0);
+            const __m128 xconst4 = _mm_set1_ps(4);
+            const __m128 xabsmask = _mm_set1_ps(0x7FFFFFFF);
+            const float *first = in - taps / 2 * step;
+
+            // 4 pixels at a time, the remaining pixels one at a time in the lowest lane
+            for (int32_t i = 0; i < n;) {
+                bool single = i + 4 > n;
+                __m128 xcenter = single ? _mm_load_ss(in + i) : _mm_loadu_ps(in + i);
+                __m128 xweight[4], xfactor[4];
+                for (int32_t k = 0; k < taps; k++) {
+                    __m128 xval = single ? _mm_load_ss(first + k * step + i) : _mm_loadu_ps(first + k * step + i);
+                    __m128 xw = _mm_and_ps(_mm_sub_ps(xval, xcenter), xabsmask);
+                    xw = _mm_max_ps(xconst0, _mm_sub_ps(xconst4, xw));
+                    __m128 xf = _mm_mul_ps(xval, xw);
+                    xweight[k & 3] = ordered(k < 4 ? xw : _mm_add_ps(xweight[k & 3], xw));
+                    xfactor[k & 3] = ordered(k < 4 ? xf : _mm_add_ps(xfactor[k & 3], xf));
+                }
+                __m128 xweight_sum = _mm_add_ps(ordered(_mm_add_ps(xweight[0], xweight[2])), ordered(_mm_add_ps(xweight[1], xweight[3])));
+                __m128 xfactor_sum = _mm_add_ps(ordered(_mm_add_ps(xfactor[0], xfactor[2])), ordered(_mm_add_ps(xfactor[1], xfactor[3])));
+                __m128 xd = EXACT_DIV_PS(xfactor_sum, xweight_sum);
+                __m128 xvalid = _mm_and_ps(_mm_cmpgt_ps(xweight_sum, xconst0), _mm_cmpge_ps(xd, xconst0));
+                if (single) {
+                    if (_mm_movemask_ps(xvalid) & 1)
+                        out[i] = _mm_cvtss_f32(xd);
+                    i++;
+                } else {
+                    __m128 xout = _mm_loadu_ps(out + i);
+                    _mm_storeu_ps(out + i, _mm_or_ps(_mm_and_ps(xvalid, xd), _mm_andnot_ps(xvalid, xout)));
+                    i += 4;
+                }
+            }
+        }
+
+#ifdef FILTER_AVX
+        __attribute__((target("avx"))) void adaptive_mean_avx(const float *in, float *out, int32_t step, int32_t taps, int32_t n) {
+            const __m256 yconst0 = _mm256_set1_ps(0);
+            const __m256 yconst4 = _mm256_set1_ps(4);
+            const __m256 yabsmask = _mm256_set1_ps(0x7FFFFFFF);
+            const float *first = in - taps / 2 * step;
+
+            // 8 pixels at a time, the rest is done by the SSE version
+            int32_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m256 ycenter = _mm256_loadu_ps(in + i);
+                __m256 yweight[4], yfactor[4];
+                for (int32_t k = 0; k < taps; k++) {
+                    __m256 yval = _mm256_loadu_ps(first + k * step + i);
+                    __m256 yw = _mm256_and_ps(_mm256_sub_ps(yval, ycenter), yabsmask);
+                    yw = _mm256_max_ps(yconst0, _mm256_sub_ps(yconst4, yw));
+                    __m256 yf = _mm256_mul_ps(yval, yw);
+                    yweight[k & 3] = ordered(k < 4 ? yw : _mm256_add_ps(yweight[k & 3], yw));
+                    yfactor[k & 3] = ordered(k < 4 ? yf : _mm256_add_ps(yfactor[k & 3], yf));
+                }
+                __m256 yweight_sum = _mm256_add_ps(ordered(_mm256_add_ps(yweight[0], yweight[2])), ordered(_mm256_add_ps(yweight[1], yweight[3])));
+                __m256 yfactor_sum = _mm256_add_ps(ordered(_mm256_add_ps(yfactor[0], yfactor[2])), ordered(_mm256_add_ps(yfactor[1], yfactor[3])));
+                __m256 yd = EXACT_DIV_PS256(yfactor_sum, yweight_sum);
+                __m256 yvalid = _mm256_and_ps(_mm256_cmp_ps(yweight_sum, yconst0, _CMP_GT_OQ), _mm256_cmp_ps(yd, yconst0, _CMP_GE_OQ));
+                _mm256_storeu_ps(out + i, _mm256_blendv_ps(_mm256_loadu_ps(out + i), yd, yvalid));
+            }
+            if (i < n)
+                adaptive_mean_sse(in + i, out + i, step, taps, n - i);
+        }
+#endif
+
+        // single pixel u of consistencyCheck()
+        static inline float consistency_check(const float *D, const float *D_other, float warp, float threshold, int32_t u, int32_t n) {
+            float u_warp = (float)u + warp * D[u];
+            if (D[u] < 0 || u_warp < 0 || u_warp >= n)
+                return -10;
+            float diff = D_other[(int32_t)u_warp] - D[u];
+            return (diff < 0 ? -diff : diff) <= threshold ? D[u] : -10;
+        }
+
+        void consistency_check_sse(const float *D, const float *D_other, float *out, float warp, float threshold, int32_t n) {
+            const __m128 xconst0 = _mm_set1_ps(0);
+            const __m128 xconst4 = _mm_set1_ps(4);
+            const __m128 xinvalid = _mm_set1_ps(-10);
+            const __m128 xabsmask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+            const __m128 xwarp = _mm_set1_ps(warp);
+            const __m128 xthreshold = _mm_set1_ps(threshold);
+            const __m128 xwidth = _mm_set1_ps((float)n);
+
+            // 4 pixels at a time, the disparities of the other image are gathered one by one
+            __m128 xu = _mm_setr_ps(0, 1, 2, 3);
+            int32_t i = 0;
+            for (; i + 4 <= n; i += 4, xu = _mm_add_ps(xu, xconst4)) {
+                __m128 xd = _mm_loadu_ps(D + i);
+                __m128 xu_warp = _mm_add_ps(xu, _mm_mul_ps(xwarp, xd));
+                __m128 xvalid = _mm_and_ps(_mm_cmpge_ps(xd, xconst0), _mm_and_ps(_mm_cmpge_ps(xu_warp, xconst0), _mm_cmplt_ps(xu_warp, xwidth)));
+                int32_t valid = _mm_movemask_ps(xvalid);
+                int32_t u_warp[4];
+                float d_other[4];
+                _mm_storeu_si128((__m128i *)u_warp, _mm_cvttps_epi32(xu_warp));
+                for (int32_t k = 0; k < 4; k++)
+                    d_other[k] = valid & (1 << k) ? D_other[u_warp[k]] : 0;
+                __m128 xdiff = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(d_other), xd), xabsmask);
+                __m128 xconsistent = _mm_and_ps(xvalid, _mm_cmple_ps(xdiff, xthreshold));
+                _mm_storeu_ps(out + i, _mm_or_ps(_mm_and_ps(xconsistent, xd), _mm_andnot_ps(xconsistent, xinvalid)));
+            }
+            for (; i < n; i++)
+                out[i] = consistency_check(D, D_other, warp, threshold, i, n);
+        }
+
+#ifdef FILTER_AVX
+        __attribute__((target("avx2"))) void consistency_check_avx2(const float *D, const float *D_other, float *out, float warp, float threshold, int32_t n) {
+            const __m256 yconst0 = _mm256_set1_ps(0);
+            const __m256 yconst8 = _mm256_set1_ps(8);
+            const __m256 yinvalid = _mm256_set1_ps(-10);
+            const __m256 yabsmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+            const __m256 ywarp = _mm256_set1_ps(warp);
+            const __m256 ythreshold = _mm256_set1_ps(threshold);
+            const __m256 ywidth = _mm256_set1_ps((float)n);
+
+            // 8 pixels at a time (masked gather of the other image), the rest one at a time
+            __m256 yu = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+            int32_t i = 0;
+            for (; i + 8 <= n; i += 8, yu = _mm256_add_ps(yu, yconst8)) {
+                __m256 yd = _mm256_loadu_ps(D + i);
+                __m256 yu_warp = _mm256_add_ps(yu, _mm256_mul_ps(ywarp, yd));
+                __m256 yvalid = _mm256_and_ps(_mm256_cmp_ps(yd, yconst0, _CMP_GE_OQ),
+                                              _mm256_and_ps(_mm256_cmp_ps(yu_warp, yconst0, _CMP_GE_OQ), _mm256_cmp_ps(yu_warp, ywidth, _CMP_LT_OQ)));
+                __m256 yd_other = _mm256_mask_i32gather_ps(yconst0, D_other, _mm256_cvttps_epi32(yu_warp), yvalid, 4);
+                __m256 ydiff = _mm256_and_ps(_mm256_sub_ps(yd_other, yd), yabsmask);
+                __m256 yconsistent = _mm256_and_ps(yvalid, _mm256_cmp_ps(ydiff, ythreshold, _CMP_LE_OQ));
+                _mm256_storeu_ps(out + i, _mm256_blendv_ps(yinvalid, yd, yconsistent));
+            }
+            for (; i < n; i++)
+                out[i] = consistency_check(D, D_other, warp, threshold, i, n);
+        }
+#endif
+    }  // namespace detail
+
+    void adaptiveMean(const float *in, float *out, int32_t step, int32_t taps, int32_t n) {
+        typedef void (*adaptive_mean_fn)(const float *, float *, int32_t, int32_t, int32_t);
+        static const adaptive_mean_fn kernel = []() -> adaptive_mean_fn {
+#ifdef FILTER_AVX
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx"))
+                return detail::adaptive_mean_avx;
+#endif
+            return detail::adaptive_mean_sse;
+        }();
+        kernel(in, out, step, taps, n);
+    }
+
+    void consistencyCheck(const float *D, const float *D_other, float *out, float warp, float threshold, int32_t n) {
+        typedef void (*consistency_check_fn)(const float *, const float *, float *, float, float, int32_t);
+        static const consistency_check_fn kernel = []() -> consistency_check_fn {
+#ifdef FILTER_AVX
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return detail::consistency_check_avx2;
+#endif
+            return detail::consistency_check_sse;
+        }();
+        kernel(D, D_other, out, warp, threshold, n);
+    }
 };  // namespace filter
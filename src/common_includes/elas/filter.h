@@ -75,10 +75,20 @@ namespace filter {
 		void convolve_row_p1p1p0m1m1_5x5(const int16_t *in, int16_t *out, int w, int h);
 
 		void convolve_cols_3x3(const unsigned char *in, int16_t *out_v, int16_t *out_h, int w, int h);
+		// kernels of adaptiveMean() below (SSE reference, AVX if available)
+		void adaptive_mean_sse(const float *in, float *out, int32_t step, int32_t taps, int32_t n);
+		void adaptive_mean_avx(const float *in, float *out, int32_t step, int32_t taps, int32_t n);
+
+		// kernels of consistencyCheck() below (SSE2 reference, AVX2 if available)
+		void consistency_check_sse(const float *D, const float *D_other, float *out, float warp, float threshold, int32_t n);
+		void consistency_check_avx2(const float *D, const float *D_other, float *out, float warp, float threshold, int32_t n);
 	}  // namespace detail
 
 	void sobel3x3(const uint8_t *in, uint8_t *out_v, uint8_t *out_h, int w, int h);
 
+	// same as above, but uses the caller provided 16bit buffers (w*h each) instead of allocating them
+	void sobel3x3(const uint8_t *in, uint8_t *out_v, uint8_t *out_h, int16_t *temp_v, int16_t *temp_h, int w, int h);
+
 	void sobel5x5(const uint8_t *in, uint8_t *out_v, uint8_t *out_h, int w, int h);
 
 	// -1 -1  0  1  1
@@ -94,6 +104,23 @@ namespace filter {
 	// -1  1  1  1 -1
 	// -1 -1 -1 -1 -1
 	void blob5x5(const uint8_t *in, int16_t *out, int w, int h);
+
+	// 7-tap median filter of the floats in[i+k*step], k = -3..3 (step 1: horizontal, step = width:
+	// vertical) for i = 0..n-1, pixels whose center[i] is invalid (< 0) keep this value
+	void median7(const float *in, const float *center, float *out, int32_t step, int32_t n);
+
+	// bilateral mean of Elas::adaptiveMean() for n consecutive pixels of in (taps 8 or 4, step 1:
+	// horizontal, step = width: vertical) over in[i+k*step], k = -taps/2..taps/2-1, the result is
+	// written to out[i] if it is a valid disparity (out[i] keeps its value otherwise); the fastest
+	// kernel supported by the CPU is used, all kernels return identical results
+	void adaptiveMean(const float *in, float *out, int32_t step, int32_t taps, int32_t n);
+
+	// L/R consistency check of a row of n disparities of Elas::leftRightConsistencyCheck(): out[u] =
+	// D[u] if D[u] is valid, its warped column u + warp * D[u] (warp -1 resp. 1 for the left resp.
+	// right image, halved for subsampling) lies inside the row and the disparity of the other image
+	// there, D_other[(int)(u + warp * D[u])], differs by no more than threshold, out[u] = -10
+	// otherwise; the fastest kernel supported by the CPU is used, all kernels return identical results
+	void consistencyCheck(const float *D, const float *D_other, float *out, float warp, float threshold, int32_t n);
 };  // namespace filter
 
 #endif
@@ -0,0 +1,348 @@
+#include "matching.h"
+
+#include <emmintrin.h>
+#include <stdlib.h>
+
+// the AVX2 / AVX-512 kernels are compiled with function level target attributes,
+// so the rest of the library does not need to be built with -mavx2 / -mavx512*
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATCHING_AVX
+#include <immintrin.h>
+#endif
+
+namespace matching {
+
+    namespace {
+
+        inline void updateSupportMinimum(const int32_t &sum,
+                                         const int16_t &d,
+                                         int16_t &min_1_E,
+                                         int16_t &min_1_d,
+                                         int16_t &min_2_E,
+                                         int16_t &min_2_d) {
+            // best + second best match
+            if (sum < min_1_E) {
+                min_2_E = min_1_E;
+                min_2_d = min_1_d;
+                min_1_E = sum;
+                min_1_d = d;
+            } else if (sum < min_2_E) {
+                min_2_E = sum;
+                min_2_d = d;
+            }
+        }
+
+        inline int32_t supportEnergy(const __m128i *xI1, const uint8_t *I2_block_addr, const int32_t *desc_offset) {
+            __m128i xmm5, xmm6;
+            xmm6 = _mm_load_si128((__m128i *)(I2_block_addr + desc_offset[0]));
+            xmm6 = _mm_sad_epu8(xI1[0], xmm6);
+            xmm5 = _mm_load_si128((__m128i *)(I2_block_addr + desc_offset[1]));
+            xmm6 = _mm_add_epi16(_mm_sad_epu8(xI1[1], xmm5), xmm6);
+            xmm5 = _mm_load_si128((__m128i *)(I2_block_addr + desc_offset[2]));
+            xmm6 = _mm_add_epi16(_mm_sad_epu8(xI1[2], xmm5), xmm6);
+            xmm5 = _mm_load_si128((__m128i *)(I2_block_addr + desc_offset[3]));
+            xmm6 = _mm_add_epi16(_mm_sad_epu8(xI1[3], xmm5), xmm6);
+            return _mm_extract_epi16(xmm6, 0) + _mm_extract_epi16(xmm6, 4);
+        }
+
+        inline void updatePosteriorMinimum(const __m128i &xI1, const uint8_t *I2_block_addr, const int32_t &d, const int32_t &w, int32_t &min_val, int32_t &min_d) {
+            __m128i xmm2 = _mm_load_si128((__m128i *)I2_block_addr);
+            xmm2 = _mm_sad_epu8(xI1, xmm2);
+            int32_t val = _mm_extract_epi16(xmm2, 0) + _mm_extract_epi16(xmm2, 4) + w;
+            if (val < min_val) {
+                min_val = val;
+                min_d = d;
+            }
+        }
+
+        // range of the prior disparities whose warped column lies inside [u_warp_min,u_warp_max]
+        inline void validPlaneRange(int32_t u,
+                                    bool right_image,
+                                    int32_t u_warp_min,
+                                    int32_t u_warp_max,
+                                    int32_t d_plane_min,
+                                    int32_t d_plane_max,
+                                    int32_t &d_lo,
+                                    int32_t &d_hi) {
+            if (!right_image) {
+                d_lo = d_plane_min > u - u_warp_max ? d_plane_min : u - u_warp_max;
+                d_hi = d_plane_max < u - u_warp_min ? d_plane_max : u - u_warp_min;
+            } else {
+                d_lo = d_plane_min > u_warp_min - u ? d_plane_min : u_warp_min - u;
+                d_hi = d_plane_max < u_warp_max - u ? d_plane_max : u_warp_max - u;
+            }
+        }
+
+        /////////////////////////////////////////////////////////////////////////////
+        // SSE2 (reference)
+        /////////////////////////////////////////////////////////////////////////////
+
+        void supportMinimumSSE2(const uint8_t *I1_block_addr,
+                                const uint8_t *I2_line_addr,
+                                const int32_t *desc_offset,
+                                int32_t u,
+                                bool right_image,
+                                int32_t d_min,
+                                int32_t d_max,
+                                int16_t &min_1_E,
+                                int16_t &min_1_d,
+                                int16_t &min_2_E,
+                                int16_t &min_2_d) {
+            __m128i xI1[4];
+            for (int32_t k = 0; k < 4; k++)
+                xI1[k] = _mm_load_si128((__m128i *)(I1_block_addr + desc_offset[k]));
+
+            for (int16_t d = d_min; d <= d_max; d++) {
+                const uint8_t *I2_block_addr = I2_line_addr + 16 * (right_image ? u + d : u - d);
+                updateSupportMinimum(supportEnergy(xI1, I2_block_addr, desc_offset), d, min_1_E, min_1_d, min_2_E, min_2_d);
+            }
+        }
+
+#ifdef MATCHING_AVX
+
+        /////////////////////////////////////////////////////////////////////////////
+        // AVX2: 2 descriptors per 256 bit SAD, batches of 4 disparities
+        /////////////////////////////////////////////////////////////////////////////
+
+        // sums the two 64 bit SAD halves of each descriptor of s0 = [c0,c1] and s1 = [c2,c3] and
+        // returns the 4 energies as 32 bit integers in the order given by xorder
+        __attribute__((target("avx2"))) inline __m128i combineEnergies4(const __m256i &s0, const __m256i &s1, const __m256i &xorder) {
+            __m256i t = _mm256_add_epi64(_mm256_unpacklo_epi64(s0, s1), _mm256_unpackhi_epi64(s0, s1));
+            return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(t, xorder));
+        }
+
+        // horizontal minimum, returns the first lane holding it if it is below min_val (else -1)
+        __attribute__((target("avx2"))) inline int32_t firstMinimum4(const __m128i &x, int32_t &min_val) {
+            __m128i m = _mm_min_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+            m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+            int32_t val = _mm_cvtsi128_si32(m);
+            if (val >= min_val)
+                return -1;
+            min_val = val;
+            return __builtin_ctz(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, m))));
+        }
+
+        __attribute__((target("avx2"))) void supportMinimumAVX2(const uint8_t *I1_block_addr,
+                                                                const uint8_t *I2_line_addr,
+                                                                const int32_t *desc_offset,
+                                                                int32_t u,
+                                                                bool right_image,
+                                                                int32_t d_min,
+                                                                int32_t d_max,
+                                                                int16_t &min_1_E,
+                                                                int16_t &min_1_d,
+                                                                int16_t &min_2_E,
+                                                                int16_t &min_2_d) {
+            __m128i xI1[4];
+            __m256i yI1[4];
+            for (int32_t k = 0; k < 4; k++) {
+                xI1[k] = _mm_load_si128((__m128i *)(I1_block_addr + desc_offset[k]));
+                yI1[k] = _mm256_broadcastsi128_si256(xI1[k]);
+            }
+
+            // disparities d..d+3 are adjacent in memory: ascending for the right image,
+            // descending for the left one, which only changes the order of the energies
+            const __m256i xorder = right_image ? _mm256_setr_epi32(0, 4, 2, 6, 0, 0, 0, 0) : _mm256_setr_epi32(4, 0, 6, 2, 0, 0, 0, 0);
+            __attribute__((aligned(16))) int32_t val[4];
+
+            int16_t d = d_min;
+            for (; d + 3 <= d_max; d += 4) {
+                const uint8_t *a0 = I2_line_addr + 16 * (right_image ? u + d : u - d - 1);
+                const uint8_t *a1 = I2_line_addr + 16 * (right_image ? u + d + 2 : u - d - 3);
+                __m256i s0 = _mm256_setzero_si256();
+                __m256i s1 = _mm256_setzero_si256();
+                for (int32_t k = 0; k < 4; k++) {
+                    s0 = _mm256_add_epi64(s0, _mm256_sad_epu8(yI1[k], _mm256_loadu_si256((__m256i *)(a0 + desc_offset[k]))));
+                    s1 = _mm256_add_epi64(s1, _mm256_sad_epu8(yI1[k], _mm256_loadu_si256((__m256i *)(a1 + desc_offset[k]))));
+                }
+                __m128i xval = combineEnergies4(s0, s1, xorder);
+
+                // only batches holding an energy below the second best can change the result
+                int32_t batch_min = min_2_E;
+                if (firstMinimum4(xval, batch_min) < 0)
+                    continue;
+                _mm_store_si128((__m128i *)val, xval);
+                for (int32_t i = 0; i < 4; i++)
+                    updateSupportMinimum(val[i], d + i, min_1_E, min_1_d, min_2_E, min_2_d);
+            }
+            for (; d <= d_max; d++) {
+                const uint8_t *I2_block_addr = I2_line_addr + 16 * (right_image ? u + d : u - d);
+                updateSupportMinimum(supportEnergy(xI1, I2_block_addr, desc_offset), d, min_1_E, min_1_d, min_2_E, min_2_d);
+            }
+        }
+
+        /////////////////////////////////////////////////////////////////////////////
+        // AVX-512: 4 descriptors per 512 bit SAD, batches of 8 disparities
+        /////////////////////////////////////////////////////////////////////////////
+
+        // 8 energies of s0 = [c0..c3] and s1 = [c4..c7] as 32 bit integers in the order given by xorder
+        __attribute__((target("avx512f,avx512bw"))) inline __m256i combineEnergies8(const __m512i &s0, const __m512i &s1, const __m256i &xorder) {
+            __m512i t = _mm512_add_epi64(_mm512_unpacklo_epi64(s0, s1), _mm512_unpackhi_epi64(s0, s1));
+            return _mm256_permutevar8x32_epi32(_mm512_cvtepi64_epi32(t), xorder);
+        }
+
+        __attribute__((target("avx512f,avx512bw"))) inline int32_t firstMinimum8(const __m256i &x, int32_t &min_val) {
+            __m128i m = _mm_min_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+            m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+            m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+            int32_t val = _mm_cvtsi128_si32(m);
+            if (val >= min_val)
+                return -1;
+            min_val = val;
+            return __builtin_ctz(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, _mm256_broadcastd_epi32(m)))));
+        }
+
+        __attribute__((target("avx512f,avx512bw"))) void supportMinimumAVX512(const uint8_t *I1_block_addr,
+                                                                              const uint8_t *I2_line_addr,
+                                                                              const int32_t *desc_offset,
+                                                                              int32_t u,
+                                                                              bool right_image,
+                                                                              int32_t d_min,
+                                                                              int32_t d_max,
+                                                                              int16_t &min_1_E,
+                                                                              int16_t &min_1_d,
+                                                                              int16_t &min_2_E,
+                                                                              int16_t &min_2_d) {
+            __m128i xI1[4];
+            __m512i zI1[4];
+            for (int32_t k = 0; k < 4; k++) {
+                xI1[k] = _mm_load_si128((__m128i *)(I1_block_addr + desc_offset[k]));
+                zI1[k] = _mm512_broadcast_i32x4(xI1[k]);
+            }
+
+            // disparities d..d+7 are adjacent in memory, see supportMinimumAVX2()
+            const __m256i xorder = right_image ? _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7) : _mm256_setr_epi32(6, 4, 2, 0, 7, 5, 3, 1);
+            __attribute__((aligned(32))) int32_t val[8];
+
+            int16_t d = d_min;
+            for (; d + 7 <= d_max; d += 8) {
+                const uint8_t *a0 = I2_line_addr + 16 * (right_image ? u + d : u - d - 3);
+                const uint8_t *a1 = I2_line_addr + 16 * (right_image ? u + d + 4 : u - d - 7);
+                __m512i s0 = _mm512_setzero_si512();
+                __m512i s1 = _mm512_setzero_si512();
+                for (int32_t k = 0; k < 4; k++) {
+                    s0 = _mm512_add_epi64(s0, _mm512_sad_epu8(zI1[k], _mm512_loadu_si512((void *)(a0 + desc_offset[k]))));
+                    s1 = _mm512_add_epi64(s1, _mm512_sad_epu8(zI1[k], _mm512_loadu_si512((void *)(a1 + desc_offset[k]))));
+                }
+                __m256i xval = combineEnergies8(s0, s1, xorder);
+
+                // only batches holding an energy below the second best can change the result
+                int32_t batch_min = min_2_E;
+                if (firstMinimum8(xval, batch_min) < 0)
+                    continue;
+                _mm256_store_si256((__m256i *)val, xval);
+                for (int32_t i = 0; i < 8; i++)
+                    updateSupportMinimum(val[i], d + i, min_1_E, min_1_d, min_2_E, min_2_d);
+            }
+            for (; d <= d_max; d++) {
+                const uint8_t *I2_block_addr = I2_line_addr + 16 * (right_image ? u + d : u - d);
+                updateSupportMinimum(supportEnergy(xI1, I2_block_addr, desc_offset), d, min_1_E, min_1_d, min_2_E, min_2_d);
+            }
+        }
+
+#endif
+
+        isa current = SSE2;
+
+        isa install(isa i) {
+            switch (i) {
+#ifdef MATCHING_AVX
+                case AVX512:
+                    supportMinimum = supportMinimumAVX512;
+                    break;
+                case AVX2:
+                    supportMinimum = supportMinimumAVX2;
+                    break;
+#endif
+                default:
+                    i = SSE2;
+                    supportMinimum = supportMinimumSSE2;
+            }
+            current = i;
+            return i;
+        }
+    }  // namespace
+
+    support_fn supportMinimum = supportMinimumSSE2;
+
+    // the posterior scores only ~10 scattered disparities per pixel, where batching them into
+    // wider SADs costs more than it saves, so it has a single SSE2 version
+    // bits of word w of a candidate mask (disparities 64*w..64*w+63) which are inside of [d_min,d_max]
+    static inline uint64_t rangeMask(int32_t w, int32_t d_min, int32_t d_max) {
+        d_min = d_min > 64 * w ? d_min - 64 * w : 0;
+        d_max = d_max < 64 * w + 63 ? d_max - 64 * w : 63;
+        if (d_min > d_max)
+            return 0;
+        return (~0ULL >> (63 - d_max)) & (~0ULL << d_min);
+    }
+
+    void posteriorMinimum(const uint8_t *I1_block_addr,
+                          const uint8_t *I2_line_addr,
+                          int32_t u,
+                          bool right_image,
+                          int32_t u_warp_min,
+                          int32_t u_warp_max,
+                          const uint64_t *d_grid,
+                          int32_t grid_words,
+                          int32_t d_plane,
+                          int32_t d_plane_min,
+                          int32_t d_plane_max,
+                          const int32_t *P,
+                          int32_t &min_val,
+                          int32_t &min_d) {
+        __m128i xI1 = _mm_load_si128((__m128i *)I1_block_addr);
+        int32_t d_curr, u_warp;
+
+        // grid disparities whose warped column is valid, in ascending order
+        int32_t d_min = right_image ? u_warp_min - u : u - u_warp_max;
+        int32_t d_max = right_image ? u_warp_max - u : u - u_warp_min;
+        for (int32_t w = 0; w < grid_words; w++) {
+            uint64_t bits = d_grid[w] & rangeMask(w, d_min, d_max) & ~rangeMask(w, d_plane_min, d_plane_max);
+            while (bits) {
+                d_curr = 64 * w + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                u_warp = right_image ? u + d_curr : u - d_curr;
+                updatePosteriorMinimum(xI1, I2_line_addr + 16 * u_warp, d_curr, 0, min_val, min_d);
+            }
+        }
+
+        int32_t d_lo, d_hi;
+        validPlaneRange(u, right_image, u_warp_min, u_warp_max, d_plane_min, d_plane_max, d_lo, d_hi);
+        for (d_curr = d_lo; d_curr <= d_hi; d_curr++) {
+            u_warp = right_image ? u + d_curr : u - d_curr;
+            updatePosteriorMinimum(xI1, I2_line_addr + 16 * u_warp, d_curr, P ? P[abs(d_curr - d_plane)] : 0, min_val, min_d);
+        }
+    }
+
+    isa detectIsa() {
+#ifdef MATCHING_AVX
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+            return AVX512;
+        if (__builtin_cpu_supports("avx2"))
+            return AVX2;
+#endif
+        return SSE2;
+    }
+
+    isa currentIsa() { return current; }
+
+    const char *isaName(isa i) {
+        switch (i) {
+            case AVX512:
+                return "AVX-512";
+            case AVX2:
+                return "AVX2";
+            default:
+                return "SSE2";
+        }
+    }
+
+    isa selectIsa(isa i) {
+        isa best = detectIsa();
+        return install(i < best ? i : best);
+    }
+
+    // pick the kernels once at startup
+    static const isa startup_isa = selectIsa(AVX512);
+}  // namespace matching
\ No newline at end of file
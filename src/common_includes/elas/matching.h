@@ -0,0 +1,79 @@
+// Descriptor matching kernels of libelas (support point matching and dense
+// matching). The support matcher exists as SSE2 reference version and as AVX2
+// and AVX-512 version, which score 2 resp. 4 candidate disparities per SAD
+// instruction. The fastest version supported by the CPU is selected at
+// startup; all versions return bit-identical results.
+
+#ifndef __MATCHING_H__
+#define __MATCHING_H__
+
+// define fixed-width datatypes for Visual Studio projects
+#ifndef _MSC_VER
+#include <stdint.h>
+#else
+typedef __int8 int8_t;
+typedef __int16 int16_t;
+typedef __int32 int32_t;
+typedef __int64 int64_t;
+typedef unsigned __int8 uint8_t;
+typedef unsigned __int16 uint16_t;
+typedef unsigned __int32 uint32_t;
+typedef unsigned __int64 uint64_t;
+#endif
+
+namespace matching {
+
+    enum isa { SSE2, AVX2, AVX512 };
+
+    // support matching: scores the 4 corner descriptors around I1_block_addr (desc_offset[0..3]
+    // relative to it) against I2 for all disparities d_min..d_max, where disparity d is located at
+    // I2_line_addr + 16 * (u - d) (left image) or I2_line_addr + 16 * (u + d) (right image), and
+    // keeps best and second best match as Elas::computeMatchingDisparity() always did
+    typedef void (*support_fn)(const uint8_t *I1_block_addr,
+                               const uint8_t *I2_line_addr,
+                               const int32_t *desc_offset,
+                               int32_t u,
+                               bool right_image,
+                               int32_t d_min,
+                               int32_t d_max,
+                               int16_t &min_1_E,
+                               int16_t &min_1_d,
+                               int16_t &min_2_E,
+                               int16_t &min_2_d);
+
+    // dense matching: minimum of the posterior energy of the descriptor at I1_block_addr over the
+    // grid disparities (set bits of the candidate mask d_grid[0..grid_words-1], ascending) outside of
+    // [d_plane_min,d_plane_max] (no prior) followed by all disparities inside of it (prior
+    // P[|d-d_plane|], or no prior if P is null); disparities whose warped column is outside of
+    // [u_warp_min,u_warp_max] are skipped, ties keep the first hit
+    void posteriorMinimum(const uint8_t *I1_block_addr,
+                          const uint8_t *I2_line_addr,
+                          int32_t u,
+                          bool right_image,
+                          int32_t u_warp_min,
+                          int32_t u_warp_max,
+                          const uint64_t *d_grid,
+                          int32_t grid_words,
+                          int32_t d_plane,
+                          int32_t d_plane_min,
+                          int32_t d_plane_max,
+                          const int32_t *P,
+                          int32_t &min_val,
+                          int32_t &min_d);
+
+    // support matcher of the currently selected instruction set
+    extern support_fn supportMinimum;
+
+    // best instruction set supported by this CPU (and the operating system)
+    isa detectIsa();
+
+    // instruction set of the current kernels
+    isa currentIsa();
+    const char *isaName(isa i);
+
+    // forces the support matcher of the given instruction set (e.g. for A/B benchmarks),
+    // falls back to the best supported one below it; returns the selected one
+    isa selectIsa(isa i);
+}  // namespace matching
+
+#endif
\ No newline at end of file
@@ -37,7 +37,7 @@ void Timer::stop() {
 void Timer::plotCpp() {
     stop();
     float total_time = 0;
-    for (int32_t i = 0; i < desc.size(); i++) {
+    for (size_t i = 0; i < desc.size(); i++) {
         float curr_time = getTimeDifferenceMilliseconds(time[i], time[i + 1]);
         total_time += curr_time;
         std::cout.width(30);
@@ -57,7 +57,7 @@ void Timer::plot() {
     stop();
     float total_time = 0;
     printf("\n%s%25s%s\n", YELLOW, "Pre Processing:", RESET);
-    for (int32_t i = 0; i < desc.size(); i++) {
+    for (size_t i = 0; i < desc.size(); i++) {
         float curr_time = getTimeDifferenceMilliseconds(time[i], time[i + 1]);
         total_time += curr_time;
         printf("%30s %.2lf ms\n", desc[i].c_str(), curr_time);
@@ -71,6 +71,53 @@ void Timer::plot() {
     reset();
 }
 
+int32_t Timer::startTask(std::string title) {
+    timeval curr_time;
+    gettimeofday(&curr_time, 0);
+    std::lock_guard<std::mutex> lock(task_mutex);
+    task_desc.push_back(title);
+    task_start.push_back(curr_time);
+    task_stop.push_back(curr_time);
+    return task_desc.size() - 1;
+}
+
+void Timer::stopTask(int32_t task) {
+    timeval curr_time;
+    gettimeofday(&curr_time, 0);
+    std::lock_guard<std::mutex> lock(task_mutex);
+    task_stop[task] = curr_time;
+}
+
+void Timer::plotTasks() {
+    if (task_desc.empty())
+        return;
+    timeval first = task_start[0], last = task_stop[0];
+    for (size_t i = 1; i < task_desc.size(); i++) {
+        if (getTimeDifferenceMilliseconds(task_start[i], first) > 0)
+            first = task_start[i];
+        if (getTimeDifferenceMilliseconds(last, task_stop[i]) > 0)
+            last = task_stop[i];
+    }
+
+    // start and end relative to the first task, overlapping rows ran concurrently
+    float busy_time = 0;
+    printf("\n%s%25s%s\n", YELLOW, "Task Graph:", RESET);
+    printf("%30s %9s %9s %9s\n", "", "start", "end", "time");
+    for (size_t i = 0; i < task_desc.size(); i++) {
+        float curr_time = getTimeDifferenceMilliseconds(task_start[i], task_stop[i]);
+        busy_time += curr_time;
+        printf("%30s %9.2lf %9.2lf %9.2lf ms\n", task_desc[i].c_str(), getTimeDifferenceMilliseconds(first, task_start[i]),
+               getTimeDifferenceMilliseconds(first, task_stop[i]), curr_time);
+    }
+    float wall_time = getTimeDifferenceMilliseconds(first, last);
+    printf("========================================\n");
+    printf("          %sWall time %.2lf ms, sum of tasks %.2lf ms (%.2fx)%s\n", GREEN, wall_time, busy_time,
+           wall_time > 0 ? busy_time / wall_time : 1.0f, RESET);
+    task_desc.clear();
+    task_start.clear();
+    task_stop.clear();
+}
+
 void Timer::reset() {
     desc.clear();
     time.clear();
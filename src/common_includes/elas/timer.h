@@ -28,6 +28,7 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 #include <sys/time.h>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -61,10 +62,22 @@ class Timer {
 
     void reset();
 
+    // intervals of tasks that may run concurrently (thread safe), startTask()
+    // returns the handle for stopTask(); plotTasks() shows them on a common time axis
+    int32_t startTask(std::string title);
+
+    void stopTask(int32_t task);
+
+    void plotTasks();
+
    private:
     std::vector<std::string> desc;
     std::vector<timeval> time;
 
+    std::mutex task_mutex;
+    std::vector<std::string> task_desc;
+    std::vector<timeval> task_start, task_stop;
+
     void push_back_time() {
         timeval curr_time;
         gettimeofday(&curr_time, 0);
@@ -544,8 +544,10 @@ float iccerrboundA, iccerrboundB, iccerrboundC;
 float o3derrboundA, o3derrboundB, o3derrboundC;
 
 /* Random number seed is not constant, but I've made it global anyway.       */
+/*   It is per thread, so that concurrent triangulations (left and right     */
+/*   image) stay reproducible.                                               */
 
-unsigned long randomseed; /* Current random number seed. */
+thread_local unsigned long randomseed; /* Current random number seed. */
 
 /* Mesh data structure.  Triangle operates on only one mesh, but the mesh    */
 /*   structure is used (instead of global variables) to allow reentrancy.    */
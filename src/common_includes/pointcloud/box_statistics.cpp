@@ -0,0 +1,87 @@
+#include "box_statistics.h"
+
+void BoxStatistics::init(int32_t width, int32_t height) {
+    this->width = width;
+    this->height = height;
+    // the first row stays 0, sumRows clears the first column
+    sums.assign(3 * (size_t)(width + 1) * (height + 1), 0);
+    counts.assign((size_t)(width + 1) * (height + 1), 0);
+}
+
+void BoxStatistics::sumRows(const uint8_t *D, int32_t D_step, const double *points, int32_t v_min, int32_t v_max) {
+    const size_t stride = width + 1;
+    for (int32_t v = v_min; v < v_max; v++) {
+        const uint8_t *D_line = D + (size_t)v * D_step;
+        const double *point = points + 3 * (size_t)v * width;
+        double *sum = sums.data() + 3 * (v + 1) * stride;
+        int32_t *count = counts.data() + (v + 1) * stride;
+        // running sums of the row, stored for every entry
+        double x = 0, y = 0, z = 0;
+        int32_t n = 0;
+        sum[0] = sum[1] = sum[2] = 0;
+        count[0] = 0;
+        for (int32_t u = 0; u < width; u++, point += 3) {
+            if (D_line[u] != 0) {
+                x += point[0];
+                y += point[1];
+                z += point[2];
+                n++;
+            }
+            sum[3 * (u + 1)] = x, sum[3 * (u + 1) + 1] = y, sum[3 * (u + 1) + 2] = z;
+            count[u + 1] = n;
+        }
+    }
+}
+
+void BoxStatistics::sumColumns(int32_t u_min, int32_t u_max) {
+    // the entries of the columns u_min + 1 to u_max hold the sums of the pixel columns u_min to u_max - 1
+    const size_t stride = width + 1;
+    for (int32_t v = 2; v <= height; v++) {
+        double *sum = sums.data() + 3 * (v * stride + u_min + 1);
+        int32_t *count = counts.data() + v * stride + u_min + 1;
+        for (int32_t i = 0; i < 3 * (u_max - u_min); i++)
+            sum[i] += sum[i - 3 * stride];
+        for (int32_t i = 0; i < u_max - u_min; i++)
+            count[i] += count[i - stride];
+    }
+}
+
+int32_t BoxStatistics::count(int32_t u_min, int32_t v_min, int32_t u_max, int32_t v_max) const {
+    const size_t stride = width + 1;
+    return counts[v_max * stride + u_max] - counts[v_min * stride + u_max] - counts[v_max * stride + u_min] + counts[v_min * stride + u_min];
+}
+
+bool BoxStatistics::mean(int32_t u_min, int32_t v_min, int32_t u_max, int32_t v_max, double *xyz) const {
+    const size_t stride = width + 1;
+    int32_t n = count(u_min, v_min, u_max, v_max);
+    if (n <= 0)
+        return false;
+    const double *a = sums.data() + 3 * (v_min * stride + u_min), *b = sums.data() + 3 * (v_min * stride + u_max);
+    const double *c = sums.data() + 3 * (v_max * stride + u_min), *d = sums.data() + 3 * (v_max * stride + u_max);
+    for (int32_t k = 0; k < 3; k++)
+        xyz[k] = (d[k] - b[k] - c[k] + a[k]) / n;
+    return true;
+}
+
+double BoxStatistics::medianDisparity(const uint8_t *D, int32_t D_step, int32_t u_min, int32_t v_min, int32_t u_max, int32_t v_max) {
+    // the pixels without a disparity land in the first bin and are taken out again
+    int32_t histogram[bins] = {0}, invalid = 0, n = 0;
+    for (int32_t v = v_min; v < v_max; v++) {
+        const uint8_t *D_line = D + (size_t)v * D_step;
+        for (int32_t u = u_min; u < u_max; u++) {
+            histogram[D_line[u] / (256 / bins)]++;
+            invalid += D_line[u] == 0;
+        }
+    }
+    histogram[0] -= invalid;
+    for (int32_t k = 0; k < bins; k++)
+        n += histogram[k];
+    if (n == 0)
+        return -1;
+    // the bin holding the middle point, then L + (n / 2 - F) / f * w with the points F below the bin
+    int32_t below = 0, k = 0;
+    while (2 * (below + histogram[k]) < n)
+        below += histogram[k++];
+    const double bin_width = 256.0 / bins;
+    return bin_width * (k + (0.5 * n - below) / histogram[k]);
+}
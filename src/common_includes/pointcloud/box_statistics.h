@@ -0,0 +1,49 @@
+#ifndef BOX_STATISTICS_H
+#define BOX_STATISTICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Statistics of the points of a disparity image within boxes (e.g. detected objects). Only the pixels with a
+// disparity (d >= 1) count. The median disparity of a box is taken from a small histogram of the disparities of the
+// box, built from the disparity image on every call; with a few boxes per frame this reads far less than any table.
+// The mean point of a box comes from summed area tables: for every pixel, the sums of x, y, z and the number of
+// points of all pixels above and to the left of it. The tables are built in two passes: the rows independently of
+// each other, then the columns independently of each other, so threads may share both passes.
+class BoxStatistics {
+   public:
+    static constexpr int32_t bins = 16;
+
+    BoxStatistics() : width(0), height(0) {}
+
+    // sets up the tables of width x height disparity images
+    void init(int32_t width, int32_t height);
+
+    // first pass: sums along the rows v_min to v_max - 1 of the disparity image D (bytes per line: D_step) and of its
+    // points (width * height x, y, z triples)
+    void sumRows(const uint8_t *D, int32_t D_step, const double *points, int32_t v_min, int32_t v_max);
+
+    // second pass, after sumRows of all rows: sums along the columns u_min to u_max - 1
+    void sumColumns(int32_t u_min, int32_t u_max);
+
+    // the box is u_min <= u < u_max, v_min <= v < v_max
+    // number of points of the box
+    int32_t count(int32_t u_min, int32_t v_min, int32_t u_max, int32_t v_max) const;
+    // mean x, y, z of the points of the box, false without points
+    bool mean(int32_t u_min, int32_t v_min, int32_t u_max, int32_t v_max, double *xyz) const;
+    // median disparity of the points of the box of the disparity image D, interpolated linearly within its bin of
+    // 256 / bins disparity values, -1 without points (needs no tables)
+    static double medianDisparity(const uint8_t *D, int32_t D_step, int32_t u_min, int32_t v_min, int32_t u_max, int32_t v_max);
+
+    int32_t getWidth() const { return width; }
+    int32_t getHeight() const { return height; }
+
+   private:
+    int32_t width, height;
+    // (height + 1) x (width + 1) entries each, the first row and column are 0
+    std::vector<double> sums;     // x, y, z, 3 per entry (doubles, floats would not keep the differences of large sums)
+    std::vector<int32_t> counts;  // number of points
+};
+
+#endif
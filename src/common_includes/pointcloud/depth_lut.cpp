@@ -0,0 +1,37 @@
+#include "depth_lut.h"
+
+#include <emmintrin.h>
+#include <math.h>
+
+#include "half_float.h"
+
+void DepthLut::init(double f, double inverse_baseline, double offset, int32_t disp_max, Format format) {
+    this->format = format;
+    table.resize(disp_max * subpixels + 1);
+    for (size_t i = 0; i < table.size(); i++) {
+        double w = inverse_baseline * i / subpixels + offset;
+        double z = w > 0 ? f / w : 0;
+        uint16_t depth = 0;
+        if (i > 0 && z > 0) {
+            if (format == DEPTH_F16) {
+                __m128i half = halfFloats(_mm_set1_ps((float)z));
+                depth = _mm_extract_epi16(half, 0);
+            } else
+                depth = (uint16_t)fmin(round(1000 * z), 65535);
+        }
+        table[i] = depth;
+    }
+}
+
+void DepthLut::convertRows(const float *D, uint16_t *depth, int32_t width, int32_t v_min, int32_t v_max) const {
+    const int32_t last = table.size() - 1;
+    for (int32_t v = v_min; v < v_max; v++) {
+        const float *D_line = D + (size_t)v * width;
+        uint16_t *depth_line = depth + (size_t)v * width;
+        for (int32_t u = 0; u < width; u++) {
+            // negative disparities end up at the entry 0, which has no depth
+            int32_t i = (int32_t)(D_line[u] * subpixels + 0.5f);
+            depth_line[u] = table[i < 0 ? 0 : i > last ? last : i];
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef DEPTH_LUT_H
+#define DEPTH_LUT_H
+
+#include <stdint.h>
+#include <vector>
+
+// Converts the float disparity images of LIBELAS to depth images of 16 bit values with a table of the depth
+// Z = f / (inverse_baseline * d + offset) at every 1 / subpixels of disparity, the nearest entry is used. Pixels
+// without a disparity (d < 0), and disparities whose depth is not positive, get 0. Nothing is allocated or written
+// after init(), so threads may convert different rows concurrently.
+class DepthLut {
+   public:
+    enum Format {
+        DEPTH_F16 = 0,    // IEEE half floats in the units of the baseline (meters for KITTI)
+        DEPTH_MM_U16 = 1  // thousandths of the units of the baseline (millimeters for KITTI), at most 65535
+    };
+
+    static constexpr int32_t subpixels = 32;  // table entries per pixel of disparity
+
+    DepthLut() : format(-1) {}
+
+    // f, inverse_baseline, offset: Q(2,3), Q(3,2) and Q(3,3) of stereoRectify
+    // disp_max: largest disparity of the images
+    void init(double f, double inverse_baseline, double offset, int32_t disp_max, Format format);
+
+    // depth of the rows v_min to v_max - 1 of the disparity image D (width floats per row), written to the same
+    // pixels of depth
+    void convertRows(const float *D, uint16_t *depth, int32_t width, int32_t v_min, int32_t v_max) const;
+
+    // Format of the table, -1 before init()
+    int32_t getFormat() const { return format; }
+
+   private:
+    int32_t format;
+    std::vector<uint16_t> table;  // depth of the disparities i / subpixels
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef HALF_FLOAT_H
+#define HALF_FLOAT_H
+
+#include <emmintrin.h>
+
+// IEEE half floats of four floats, rounded to the nearest even as _mm_cvtps_ph does, in the low 16 bits of
+// every lane with the sign extended (as _mm_packs_epi32 expects)
+static inline __m128i halfFloats(__m128 f) {
+    const __m128i sign_mask = _mm_set1_epi32(0x80000000);
+    const __m128i f16_max = _mm_set1_epi32((127 + 16) << 23);      // floats from 2^16 up are infinite halfs
+    const __m128i min_normal = _mm_set1_epi32((127 - 14) << 23);   // smallest float giving a normal half
+    const __m128i subnormal_magic = _mm_set1_epi32((127 - 15 + 23 - 10 + 1) << 23);
+    const __m128i normal_bias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));  // rebias the exponent, round
+
+    __m128 sign = _mm_and_ps(f, _mm_castsi128_ps(sign_mask));
+    __m128 abs_f = _mm_xor_ps(f, sign);
+    __m128i abs_i = _mm_castps_si128(abs_f);
+    __m128i is_regular = _mm_cmpgt_epi32(f16_max, abs_i);
+    __m128i is_subnormal = _mm_cmpgt_epi32(min_normal, abs_i);
+    // NaNs are found on the bits, -ffast-math folds _mm_cmpunord_ps to false
+    __m128i is_nan = _mm_cmpgt_epi32(abs_i, _mm_set1_epi32(0x7f800000));
+    __m128i inf_or_nan = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(is_nan, _mm_set1_epi32(0x200)));
+
+    // subnormal halfs: the float addition rounds the mantissa at 2^-24
+    __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(abs_f, _mm_castsi128_ps(subnormal_magic))), subnormal_magic);
+    // normal halfs: add just below half of the dropped bits, plus one if the kept mantissa is odd
+    __m128i odd = _mm_srai_epi32(_mm_slli_epi32(abs_i, 31 - 13), 31);
+    __m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(abs_i, normal_bias), odd), 13);
+
+    __m128i half = _mm_or_si128(_mm_and_si128(is_subnormal, subnormal), _mm_andnot_si128(is_subnormal, normal));
+    half = _mm_or_si128(_mm_and_si128(is_regular, half), _mm_andnot_si128(is_regular, inf_or_nan));
+    return _mm_or_si128(half, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+
+#endif
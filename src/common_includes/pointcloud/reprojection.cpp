@@ -0,0 +1,247 @@
+#include "reprojection.h"
+
+#include <emmintrin.h>
+#include <float.h>
+#include <string.h>
+
+#include "half_float.h"
+
+// the F16C conversion is compiled with a function level target attribute and selected at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REPROJECTION_F16C
+#include <immintrin.h>
+#endif
+
+void Reprojection::init(const double *Q, const double *XR, const double *XT, int32_t width, int32_t height) {
+    this->width = width;
+    this->height = height;
+
+    // A = [XR XT; 0 0 0 1] * Q
+    double T[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+    if (XR && XT) {
+        for (int32_t k = 0; k < 3; k++) {
+            for (int32_t l = 0; l < 3; l++)
+                T[k][l] = XR[3 * k + l];
+            T[k][3] = XT[k];
+        }
+    }
+    double A[4][4];
+    for (int32_t k = 0; k < 4; k++) {
+        for (int32_t l = 0; l < 4; l++) {
+            A[k][l] = 0;
+            for (int32_t m = 0; m < 4; m++)
+                A[k][l] += T[k][m] * Q[4 * m + l];
+        }
+    }
+
+    column_terms.resize(4 * width);
+    for (int32_t k = 0; k < 4; k++)
+        for (int32_t u = 0; u < width; u++)
+            column_terms[k * width + u] = A[k][0] * u + A[k][3];
+    row_terms.resize(4 * height);
+    for (int32_t v = 0; v < height; v++)
+        for (int32_t k = 0; k < 4; k++)
+            row_terms[4 * v + k] = A[k][1] * v;
+    for (int32_t k = 0; k < 4; k++)
+        A_d[k] = A[k][2];
+}
+
+// writes the point (x, y, z) as the point i of points in the given format, plane: points per plane of PLANES_F32
+template <Reprojection::Format format>
+static inline void storePoint(void *points, size_t i, size_t plane, double x, double y, double z) {
+    if (format == Reprojection::XYZ_F64) {
+        double *point = (double *)points + 3 * i;
+        point[0] = x, point[1] = y, point[2] = z;
+    } else if (format == Reprojection::XYZ_F32) {
+        float *point = (float *)points + 3 * i;
+        point[0] = (float)x, point[1] = (float)y, point[2] = (float)z;
+    } else if (format == Reprojection::XYZ_F16) {
+        __m128i xyz = halfFloats(_mm_setr_ps((float)x, (float)y, (float)z, 0));
+        int64_t bits = _mm_cvtsi128_si64(_mm_packs_epi32(xyz, xyz));
+        memcpy((uint16_t *)points + 3 * i, &bits, 6);
+    } else {
+        float *point = (float *)points + i;
+        point[0] = (float)x, point[plane] = (float)y, point[2 * plane] = (float)z;
+    }
+}
+
+// converts the 24 floats of 8 XYZ_F32 points to the 8 XYZ_F16 points of halfs
+typedef void (*store_halfs_fn)(uint16_t *halfs, const float *f);
+
+static void storeHalfsSSE2(uint16_t *halfs, const float *f) {
+    for (int32_t k = 0; k < 24; k += 8) {
+        __m128i h = _mm_packs_epi32(halfFloats(_mm_load_ps(f + k)), halfFloats(_mm_load_ps(f + k + 4)));
+        _mm_storeu_si128((__m128i *)(halfs + k), h);
+    }
+}
+
+#ifdef REPROJECTION_F16C
+__attribute__((target("avx,f16c"))) static void storeHalfsF16C(uint16_t *halfs, const float *f) {
+    for (int32_t k = 0; k < 24; k += 8)
+        _mm_storeu_si128((__m128i *)(halfs + k), _mm256_cvtps_ph(_mm256_loadu_ps(f + k), _MM_FROUND_TO_NEAREST_INT));
+}
+#endif
+
+static store_halfs_fn selectStoreHalfs() {
+    static const store_halfs_fn kernel = []() -> store_halfs_fn {
+#ifdef REPROJECTION_F16C
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c"))
+            return storeHalfsF16C;
+#endif
+        return storeHalfsSSE2;
+    }();
+    return kernel;
+}
+
+Reprojection::Limits::Limits() : d_min(1) {
+    for (int32_t k = 0; k < 3; k++)
+        min[k] = -DBL_MAX, max[k] = DBL_MAX;
+}
+
+void Reprojection::reprojectRows(const uint8_t *D, int32_t D_step, void *points, int32_t v_min, int32_t v_max, Format format) const {
+    switch (format) {
+        case XYZ_F64:
+            reprojectRowsAs<XYZ_F64, false>(D, D_step, points, v_min, v_max, 0, 0);
+            break;
+        case XYZ_F32:
+            reprojectRowsAs<XYZ_F32, false>(D, D_step, points, v_min, v_max, 0, 0);
+            break;
+        case XYZ_F16:
+            reprojectRowsAs<XYZ_F16, false>(D, D_step, points, v_min, v_max, 0, 0);
+            break;
+        case PLANES_F32:
+            reprojectRowsAs<PLANES_F32, false>(D, D_step, points, v_min, v_max, 0, 0);
+            break;
+    }
+}
+
+int32_t Reprojection::reprojectRowsCompact(const uint8_t *D, int32_t D_step, void *points, int32_t v_min, int32_t v_max, const Limits &limits,
+                                           Format format, bool from_start) const {
+    size_t first = from_start ? 0 : (size_t)v_min * width;
+    switch (format) {
+        case XYZ_F64:
+            return reprojectRowsAs<XYZ_F64, true>(D, D_step, points, v_min, v_max, &limits, first);
+        case XYZ_F32:
+            return reprojectRowsAs<XYZ_F32, true>(D, D_step, points, v_min, v_max, &limits, first);
+        case XYZ_F16:
+            return reprojectRowsAs<XYZ_F16, true>(D, D_step, points, v_min, v_max, &limits, first);
+        case PLANES_F32:
+            return reprojectRowsAs<PLANES_F32, true>(D, D_step, points, v_min, v_max, &limits, first);
+    }
+    return 0;
+}
+
+void Reprojection::reprojectPoint(int32_t u, int32_t v, double d, double *xyz) const {
+    const double *row = row_terms.data() + 4 * v;
+    double inv = 1.0 / ((column_terms[3 * width + u] + row[3]) + A_d[3] * d);
+    for (int32_t k = 0; k < 3; k++)
+        xyz[k] = ((column_terms[k * width + u] + row[k]) + A_d[k] * d) * inv;
+}
+
+int32_t Reprojection::packRows(void *points, const int32_t *counts, Format format) const {
+    // every row moves towards the front, never past the start of its own points, so the rows are moved in order
+    const size_t plane = (size_t)width * height;
+    const size_t size = format == PLANES_F32 ? sizeof(float) : pointSize(format);
+    uint8_t *point = (uint8_t *)points;
+    size_t n = 0;
+    for (int32_t v = 0; v < height; v++) {
+        size_t i = (size_t)v * width;
+        if (format == PLANES_F32) {
+            for (int32_t k = 0; k < 3; k++)
+                memmove(point + (k * plane + n) * size, point + (k * plane + i) * size, counts[v] * size);
+        } else
+            memmove(point + n * size, point + i * size, counts[v] * size);
+        n += counts[v];
+    }
+    return n;
+}
+
+template <Reprojection::Format format, bool compact>
+int32_t Reprojection::reprojectRowsAs(const uint8_t *D, int32_t D_step, void *points, int32_t v_min, int32_t v_max, const Limits *limits,
+                                      size_t first) const {
+    const double *column_x = column_terms.data();
+    const double *column_y = column_x + width;
+    const double *column_z = column_y + width;
+    const double *column_w = column_z + width;
+    const __m128d xA_x = _mm_set1_pd(A_d[0]), xA_y = _mm_set1_pd(A_d[1]), xA_z = _mm_set1_pd(A_d[2]), xA_w = _mm_set1_pd(A_d[3]);
+    const __m128d xone = _mm_set1_pd(1.0);
+    const size_t plane = (size_t)width * height;
+    const store_halfs_fn storeHalfs = selectStoreHalfs();
+    alignas(16) float f16_buffer[24];
+    int32_t n = 0;
+
+    // whether the point (x, y, z) of the disparity d is kept by limits
+    auto inside = [limits](uint8_t d, double x, double y, double z) {
+        return d >= limits->d_min && x > limits->min[0] && x < limits->max[0] && y > limits->min[1] && y < limits->max[1] &&
+               z > limits->min[2] && z < limits->max[2];
+    };
+
+    for (int32_t v = v_min; v < v_max; v++) {
+        const uint8_t *D_line = D + (size_t)v * D_step;
+        const double *row = row_terms.data() + 4 * v;
+        size_t i = (size_t)v * width;  // index of the first point of the row
+        const __m128d xrow_x = _mm_set1_pd(row[0]), xrow_y = _mm_set1_pd(row[1]), xrow_z = _mm_set1_pd(row[2]), xrow_w = _mm_set1_pd(row[3]);
+
+        // XYZ_F16 converts the floats of 8 points at a time, the rest of the row is left to the scalar loop
+        const int32_t u_end = format == XYZ_F16 && !compact ? width & ~7 : width;
+        int32_t u = 0;
+        for (; u + 1 < u_end; u += 2) {
+            __m128d xd = _mm_set_pd(D_line[u + 1], D_line[u]);
+            __m128d xw = _mm_add_pd(_mm_add_pd(_mm_loadu_pd(column_w + u), xrow_w), _mm_mul_pd(xA_w, xd));
+            __m128d xinv = _mm_div_pd(xone, xw);
+            __m128d xx = _mm_mul_pd(_mm_add_pd(_mm_add_pd(_mm_loadu_pd(column_x + u), xrow_x), _mm_mul_pd(xA_x, xd)), xinv);
+            __m128d xy = _mm_mul_pd(_mm_add_pd(_mm_add_pd(_mm_loadu_pd(column_y + u), xrow_y), _mm_mul_pd(xA_y, xd)), xinv);
+            __m128d xz = _mm_mul_pd(_mm_add_pd(_mm_add_pd(_mm_loadu_pd(column_z + u), xrow_z), _mm_mul_pd(xA_z, xd)), xinv);
+
+            if (compact) {
+                alignas(16) double x[2], y[2], z[2];
+                _mm_store_pd(x, xx);
+                _mm_store_pd(y, xy);
+                _mm_store_pd(z, xz);
+                for (int32_t k = 0; k < 2; k++)
+                    if (inside(D_line[u + k], x[k], y[k], z[k]))
+                        storePoint<format>(points, first + n++, plane, x[k], y[k], z[k]);
+            } else if (format == XYZ_F64) {
+                // the two points as (x0, y0), (z0, x1), (y1, z1)
+                double *point = (double *)points + 3 * (i + u);
+                _mm_storeu_pd(point, _mm_unpacklo_pd(xx, xy));
+                _mm_storeu_pd(point + 2, _mm_shuffle_pd(xz, xx, 2));
+                _mm_storeu_pd(point + 4, _mm_unpackhi_pd(xy, xz));
+            } else {
+                // (x0, x1, y0, y1) and (z0, z1) as floats
+                __m128 fxy = _mm_movelh_ps(_mm_cvtpd_ps(xx), _mm_cvtpd_ps(xy));
+                __m128 fz = _mm_cvtpd_ps(xz);
+                if (format == PLANES_F32) {
+                    float *point = (float *)points + i + u;
+                    _mm_storel_pi((__m64 *)point, fxy);
+                    _mm_storeh_pi((__m64 *)(point + plane), fxy);
+                    _mm_storel_pi((__m64 *)(point + 2 * plane), fz);
+                } else {
+                    alignas(16) float f[8];
+                    _mm_store_ps(f, fxy);
+                    _mm_store_ps(f + 4, fz);
+                    float *point = format == XYZ_F32 ? (float *)points + 3 * (i + u) : f16_buffer + 3 * (u & 7);
+                    point[0] = f[0], point[1] = f[2], point[2] = f[4];
+                    point[3] = f[1], point[4] = f[3], point[5] = f[5];
+                    if (format == XYZ_F16 && (u & 7) == 6)
+                        storeHalfs((uint16_t *)points + 3 * (i + u - 6), f16_buffer);
+                }
+            }
+        }
+
+        // last column of odd widths (last columns of XYZ_F16), with the same operations in the same order
+        for (; u < width; u++) {
+            double d = D_line[u];
+            double inv = 1.0 / ((column_w[u] + row[3]) + A_d[3] * d);
+            double x = ((column_x[u] + row[0]) + A_d[0] * d) * inv;
+            double y = ((column_y[u] + row[1]) + A_d[1] * d) * inv;
+            double z = ((column_z[u] + row[2]) + A_d[2] * d) * inv;
+            if (!compact)
+                storePoint<format>(points, i + u, plane, x, y, z);
+            else if (inside(D_line[u], x, y, z))
+                storePoint<format>(points, first + n++, plane, x, y, z);
+        }
+    }
+    return n;
+}
@@ -0,0 +1,73 @@
+#ifndef REPROJECTION_H
+#define REPROJECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Converts disparity images to point clouds. With the homogeneous image point p = (u, v, d, 1)^T of the
+// column u, the row v and the disparity d, the point is (A p)_xyz / (A p)_w for A = [XR XT; 0 0 0 1] * Q:
+// Q reprojects p into the frame of the left camera and (XR, XT) moves it into the robot frame.
+// The terms of A p which only depend on the column and on the row are computed once in init(), every
+// pixel then costs four multiply-adds and a division, two pixels at a time with SSE2. No method allocates
+// or writes shared state after init(), so threads may convert different rows concurrently, and every
+// point only depends on its own pixel, so the result is the same for any split of the rows.
+class Reprojection {
+   public:
+    // memory layouts of the points
+    enum Format {
+        XYZ_F64 = 0,    // x, y, z of every point as doubles (Double3)
+        XYZ_F32 = 1,    // x, y, z of every point as floats
+        XYZ_F16 = 2,    // x, y, z of every point as IEEE half floats (round to nearest even)
+        PLANES_F32 = 3  // x of all points, then y of all points, then z of all points as floats
+    };
+
+    Reprojection() : width(0), height(0) {}
+
+    // Q: 4x4 reprojection matrix of stereoRectify (row major)
+    // XR, XT: rotation (3x3, row major) and translation (3x1) from the camera to the robot frame, 0 for
+    //         the frame of the left camera
+    // width, height: size of the disparity images
+    void init(const double *Q, const double *XR, const double *XT, int32_t width, int32_t height);
+
+    // points of the rows v_min to v_max - 1 of the disparity image D (bytes per line: D_step), written in
+    // the given format to the point v * width + u of points (width * height points)
+    void reprojectRows(const uint8_t *D, int32_t D_step, void *points, int32_t v_min, int32_t v_max, Format format = XYZ_F64) const;
+
+    // points kept by reprojectRowsCompact: d >= d_min and the open ranges min[k] < x_k < max[k] for x, y and z
+    struct Limits {
+        double min[3], max[3];
+        int32_t d_min;  // smallest value of the disparity image
+        Limits();       // all points with a disparity and finite coordinates
+    };
+
+    // like reprojectRows, but only writes the points inside limits, row by row and without gaps from the point
+    // v_min * width on, or from the first point with from_start (PLANES_F32 keeps the plane size width * height),
+    // returns the number of points written
+    int32_t reprojectRowsCompact(const uint8_t *D, int32_t D_step, void *points, int32_t v_min, int32_t v_max, const Limits &limits,
+                                 Format format = XYZ_F64, bool from_start = false) const;
+
+    // moves the points of all rows together after one reprojectRowsCompact call per row v wrote counts[v]
+    // points, returns the total
+    int32_t packRows(void *points, const int32_t *counts, Format format = XYZ_F64) const;
+
+    // point of the pixel (u, v) at the (fractional) disparity image value d
+    void reprojectPoint(int32_t u, int32_t v, double d, double *xyz) const;
+
+    // bytes per point of a format
+    static int32_t pointSize(Format format) { return format == XYZ_F64 ? 24 : format == XYZ_F16 ? 6 : 12; }
+
+    int32_t getWidth() const { return width; }
+    int32_t getHeight() const { return height; }
+
+   private:
+    template <Format format, bool compact>
+    int32_t reprojectRowsAs(const uint8_t *D, int32_t D_step, void *points, int32_t v_min, int32_t v_max, const Limits *limits, size_t first) const;
+
+    int32_t width, height;
+    double A_d[4];                     // disparity column of A
+    std::vector<double> column_terms;  // A[k][0] * u + A[k][3] of all columns, for k = 0..3 one block of width values
+    std::vector<double> row_terms;     // A[k][1] * v of all rows, 4 values per row
+};
+
+#endif
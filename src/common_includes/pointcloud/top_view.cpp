@@ -0,0 +1,76 @@
+#include "top_view.h"
+
+#include <float.h>
+#include <math.h>
+
+void TopView::init(const float *x_range, const float *y_range, const float *z_range, float scale, float hit_probability) {
+    this->scale = scale;
+    this->hit_probability = hit_probability;
+    row_offset = (int32_t)truncf(x_range[1] * scale);
+    col_offset = (int32_t)truncf(y_range[1] * scale);
+    rows = row_offset - (int32_t)truncf(x_range[0] * scale) + 1;
+    cols = col_offset - (int32_t)truncf(y_range[0] * scale) + 1;
+    const float *ranges[3] = {x_range, y_range, z_range};
+    for (int32_t k = 0; k < 3; k++) {
+        limits.min[k] = ranges[k][0];
+        limits.max[k] = ranges[k][1];
+    }
+    grid.assign((size_t)LAYERS * rows * cols, 0);
+    parts.clear();
+}
+
+void TopView::begin(const Reprojection &reprojection, int32_t parts) {
+    if ((int32_t)this->parts.size() < parts)
+        this->parts.resize(parts);
+    used_parts = parts;
+    const size_t cells = (size_t)rows * cols;
+    for (int32_t p = 0; p < parts; p++) {
+        Part &part = this->parts[p];
+        part.max_height.assign(cells, -FLT_MAX);
+        part.min_height.assign(cells, FLT_MAX);
+        part.count.assign(cells, 0);
+        part.row_points.resize(3 * reprojection.getWidth());
+    }
+}
+
+void TopView::accumulate(const Reprojection &reprojection, const uint8_t *D, int32_t D_step, int32_t v_min, int32_t v_max, int32_t part) {
+    Part &p = parts[part];
+    float *point = p.row_points.data();
+    for (int32_t v = v_min; v < v_max; v++) {
+        int32_t n = reprojection.reprojectRowsCompact(D, D_step, point, v, v + 1, limits, Reprojection::XYZ_F32, true);
+        for (int32_t i = 0; i < n; i++) {
+            float x = point[3 * i], y = point[3 * i + 1], z = point[3 * i + 2];
+            // the limits of the points are open, but they are rounded to floats after the test
+            int32_t row = row_offset - (int32_t)(x * scale), col = col_offset - (int32_t)(y * scale);
+            if (row < 0 || row >= rows || col < 0 || col >= cols)
+                continue;
+            size_t cell = (size_t)row * cols + col;
+            if (z > p.max_height[cell])
+                p.max_height[cell] = z;
+            if (z < p.min_height[cell])
+                p.min_height[cell] = z;
+            p.count[cell]++;
+        }
+    }
+}
+
+void TopView::finish() {
+    const size_t cells = (size_t)rows * cols;
+    float *max_height = grid.data() + MAX_HEIGHT * cells, *min_height = grid.data() + MIN_HEIGHT * cells;
+    float *density = grid.data() + DENSITY * cells, *occupancy = grid.data() + OCCUPANCY * cells;
+    const float log_miss = logf(1 - hit_probability);
+    for (size_t cell = 0; cell < cells; cell++) {
+        float z_max = -FLT_MAX, z_min = FLT_MAX;
+        int32_t count = 0;
+        for (int32_t p = 0; p < used_parts; p++) {
+            const Part &part = parts[p];
+            z_max = fmaxf(z_max, part.max_height[cell]);
+            z_min = fminf(z_min, part.min_height[cell]);
+            count += part.count[cell];
+        }
+        max_height[cell] = count ? z_max : 0;
+        min_height[cell] = count ? z_min : 0;
+        density[cell] = count;
+        occupancy[cell] = count ? 1 - expf(log_miss * count) : 0;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef TOP_VIEW_H
+#define TOP_VIEW_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "reprojection.h"
+
+// Bird's eye view grid of the points of disparity images, in the robot frame (x forward, y left, z up). As in
+// points_2_top_view of sv.py, the cell of a point is the row trunc(x_max * scale) - trunc(x * scale) and the column
+// trunc(y_max * scale) - trunc(y * scale), so the vehicle looks up the image. The points are reprojected row by row
+// into a small buffer and never stored. Every thread rasterizes its rows into its own partial grid, finish() merges
+// them, so the result does not depend on the number of threads or on the split of the rows.
+class TopView {
+   public:
+    // layers of the grid, each rows x cols floats
+    enum Layer {
+        MAX_HEIGHT = 0,  // largest z of the points of the cell (0 without points)
+        MIN_HEIGHT = 1,  // smallest z of the points of the cell (0 without points)
+        DENSITY = 2,     // number of points in the cell
+        OCCUPANCY = 3,   // 1 - (1 - hit_probability)^DENSITY
+        LAYERS = 4
+    };
+
+    TopView() : rows(0), cols(0) {}
+
+    // x_range, y_range, z_range: {min, max} of the mapped points (exclusive)
+    // scale: cells per unit of length
+    // hit_probability: probability that a cell with a single point is occupied
+    void init(const float *x_range, const float *y_range, const float *z_range, float scale, float hit_probability);
+
+    // clears the partial grids of parts threads for the disparity images of the size of reprojection
+    void begin(const Reprojection &reprojection, int32_t parts);
+
+    // adds the points of the rows v_min to v_max - 1 of the disparity image D (bytes per line: D_step) to the partial
+    // grid part, different parts may be filled concurrently
+    void accumulate(const Reprojection &reprojection, const uint8_t *D, int32_t D_step, int32_t v_min, int32_t v_max, int32_t part);
+
+    // merges the partial grids into the layers of getGrid()
+    void finish();
+
+    // LAYERS x rows x cols floats
+    float *getGrid() { return grid.data(); }
+    int32_t getRows() const { return rows; }
+    int32_t getCols() const { return cols; }
+
+   private:
+    // per thread state, cells in the layout of the grid
+    struct Part {
+        std::vector<float> max_height, min_height;
+        std::vector<int32_t> count;
+        std::vector<float> row_points;  // XYZ_F32 points of the current disparity row
+    };
+
+    int32_t rows, cols;
+    int32_t row_offset, col_offset;  // trunc(x_max * scale), trunc(y_max * scale)
+    float scale, hit_probability;
+    Reprojection::Limits limits;
+    std::vector<Part> parts;
+    int32_t used_parts;
+    std::vector<float> grid;
+};
+
+#endif
@@ -48,6 +48,9 @@ typedef unsigned __int32 uint32_t;
 typedef unsigned __int64 uint64_t;
 #endif
 
+#include "../../common_includes/elas/delaunay.h"
+#include "../../common_includes/elas/descriptor.h"
+
 #ifdef PROFILE
 #include "../../common_includes/elas/timer.h"
 #endif
@@ -83,6 +86,13 @@ class Elas {
         bool subsampling;             // saves time by only computing disparities for each 2nd pixel
                                       // note: for this option D1 and D2 must be passed with size
                                       //       width/2 x height/2 (rounded towards zero)
+        bool postprocess_fused;       // runs the L/R consistency check and the post processing in cache sized row
+                                      // bands instead of one image wide pass per step (same results)
+        bool temporal;                // video mode: support points of the previous frame are re-verified in a small
+                                      // disparity window, the full search only runs where this fails
+        int32_t temporal_radius;      // disparity window (+-) around the previous support point in video mode
+        int32_t temporal_refresh;     // video mode: every n-th candidate row gets a full search anyway, rotating from
+                                      // frame to frame such that errors can not persist (0: never)
 
         // constructor
         parameters(setting s = ROBOTICS) {
@@ -113,6 +123,10 @@ class Elas {
                 filter_adaptive_mean = 1;
                 postprocess_only_left = 1;
                 subsampling = 0;
+                postprocess_fused = 0;
+                temporal = 0;
+                temporal_radius = 2;
+                temporal_refresh = 10;
 
                 // default settings for middlebury benchmark
                 // (interpolate all missing disparities)
@@ -140,6 +154,10 @@ class Elas {
                 filter_adaptive_mean = 0;
                 postprocess_only_left = 0;
                 subsampling = 0;
+                postprocess_fused = 0;
+                temporal = 0;
+                temporal_radius = 2;
+                temporal_refresh = 10;
             }
         }
     };
@@ -148,7 +166,21 @@ class Elas {
     Elas(parameters param) : param(param) {}
 
     // deconstructor
-    ~Elas() {}
+    ~Elas() { releaseWorkspace(); }
+
+    // changes the parameter set, the workspace is rebuilt on the next call of process()
+    void setParameters(parameters param) {
+        this->param = param;
+        ws.valid = false;
+    }
+
+    // optional bounds of the disparity range per image row (e.g. from a ground plane prior): the support
+    // points and the dense disparities of row v lie within d_min[v] .. d_max[v], rows must equal the image
+    // height passed to process() (otherwise the bounds are ignored), rows = 0 removes them
+    void setRowDisparityRange(const int32_t *d_min, const int32_t *d_max, int32_t rows) {
+        row_disp_min.assign(d_min, d_min + rows);
+        row_disp_max.assign(d_max, d_max + rows);
+    }
 
     // matching function
     // inputs: pointers to left (I1) and right (I2) intensity image (uint8, input)
@@ -159,9 +191,20 @@ class Elas {
     //         note: D1 and D2 must be allocated before (bytes per line = width)
     //               if subsampling is not active their size is width x height,
     //               otherwise width/2 x height/2 (rounded towards zero)
-    void process(uint8_t *I1, uint8_t *I2, float *D1, float *D2, const int32_t *dims);
+    //         roi (optional) = {u, v, width, height} of the region of interest: only it, roi_halo pixels
+    //               around it and the disparity range left of it are matched, D1 and D2 are -1 outside of it
+    void process(uint8_t *I1, uint8_t *I2, float *D1, float *D2, const int32_t *dims, const int32_t *roi = 0);
+
+    // number of heap allocations done by process() so far (workspace, descriptors and triangulators);
+    // once the workspace is built for the current dims and parameters this stays constant
+    uint64_t getAllocationCount() {
+        return ws.allocations + ws.desc1.allocations + ws.desc2.allocations + ws.delaunay1.allocations + ws.delaunay2.allocations;
+    }
 
    private:
+    // the checks in tests/ run the internal steps against reference implementations
+    friend struct ElasTest;
+
     struct support_pt {
         int32_t u;
         int32_t v;
@@ -182,6 +225,77 @@ class Elas {
         return (y * width + x) * disp_num + d;
     }
 
+    // buffers reused across calls of process(), sized for the current dims and parameters
+    struct workspace {
+        bool valid;
+        int32_t width, height;
+        uint64_t allocations;
+
+        Descriptor desc1, desc2;
+        Delaunay delaunay1, delaunay2;
+
+        int32_t grid_dims[3];
+        uint64_t *disparity_grid_1, *disparity_grid_2;  // candidate disparity masks, grid_dims[0] words per cell
+        uint64_t *grid_temp[2];  // createGrid() masks before the dilation for the left / right image
+
+        int16_t *D_can;
+        int32_t D_can_width, D_can_height;
+        int16_t *D_can_prev;  // left/right consistent candidates of the previous frame (video mode)
+        int32_t frames;       // frames processed since the workspace was built
+        int32_t *D_can_support;  // removeInconsistentSupportPoints() support counts
+
+        int32_t *P;  // prior
+        int32_t *pointlist;  // u and v of the support points in the left and the right image
+
+        // scratch images for the post processing (disparity image size), one set per
+        // image, since the left and right image are post processed concurrently
+        float *D_tmp1[2], *D_tmp2[2];
+        int32_t *seg_parent[2], *seg_size[2];  // removeSmallSegments() union-find forest and segment sizes
+        float *D_band;  // postProcessFused() scratch bands, one set per thread
+        int32_t band_threads;
+
+        std::vector<support_pt> p_support;
+        std::vector<triangle> tri_1, tri_2;
+
+        workspace()
+            : valid(false),
+              width(0),
+              height(0),
+              allocations(0),
+              disparity_grid_1(0),
+              disparity_grid_2(0),
+              grid_temp{0, 0},
+              D_can(0),
+              D_can_prev(0),
+              frames(0),
+              D_can_support(0),
+              P(0),
+              pointlist(0),
+              D_tmp1{0, 0},
+              D_tmp2{0, 0},
+              seg_parent{0, 0},
+              seg_size{0, 0},
+              D_band(0),
+              band_threads(0) {}
+    };
+
+    void allocateWorkspace();
+    void releaseWorkspace();
+
+    template <typename T>
+    T *allocateBuffer(size_t n) {
+        ws.allocations++;
+        return (T *)_mm_malloc(n * sizeof(T), 16);
+    }
+
+    template <typename T>
+    void reserveVector(std::vector<T> &vec, size_t n) {
+        if (vec.capacity() < n) {
+            ws.allocations++;
+            vec.reserve(n);
+        }
+    }
+
     // support point functions
     void removeInconsistentSupportPoints(int16_t *D_can, int32_t D_can_width, int32_t D_can_height);
     void removeRedundantSupportPoints(int16_t *D_can,
@@ -191,36 +305,24 @@ class Elas {
                                       int32_t redun_threshold,
                                       bool vertical);
     void addCornerSupportPoints(std::vector<support_pt> &p_support);
-    inline int16_t computeMatchingDisparity(const int32_t &u, const int32_t &v, uint8_t *I1_desc, uint8_t *I2_desc, const bool &right_image);
-    std::vector<support_pt> computeSupportMatches(uint8_t *I1_desc, uint8_t *I2_desc);
+    inline int16_t computeMatchingDisparity(const int32_t &u, const int32_t &v, uint8_t *I1_desc, uint8_t *I2_desc, const bool &right_image,
+                                          const int32_t &disp_min_window = -1, const int32_t &disp_max_window = -1);
+    void computeSupportMatches(uint8_t *I1_desc, uint8_t *I2_desc, std::vector<support_pt> &p_support);
 
     // triangulation & grid
-    std::vector<triangle> computeDelaunayTriangulation(std::vector<support_pt> p_support, int32_t right_image);
-    void computeDisparityPlanes(std::vector<support_pt> p_support, std::vector<triangle> &tri, int32_t right_image);
-    void createGrid(std::vector<support_pt> p_support, int32_t *disparity_grid, int32_t *grid_dims, bool right_image);
+    void computeDelaunayTriangulation(const std::vector<support_pt> &p_support, int32_t right_image, std::vector<triangle> &tri);
+    void computeDisparityPlanes(const std::vector<support_pt> &p_support, std::vector<triangle> &tri, int32_t right_image);
+    static constexpr int32_t plane_block = 64;  // triangles per computeDisparityPlanesBlock() call
+    void computeDisparityPlanesBlock(const std::vector<support_pt> &p_support, triangle *tri, int32_t n);
+    void createGrid(const std::vector<support_pt> &p_support, uint64_t *disparity_grid, int32_t *grid_dims, bool right_image);
 
     // matching
-    inline void updatePosteriorMinimum(__m128i *I2_block_addr,
-                                       const int32_t &d,
-                                       const int32_t &w,
-                                       const __m128i &xmm1,
-                                       __m128i &xmm2,
-                                       int32_t &val,
-                                       int32_t &min_val,
-                                       int32_t &min_d);
-    inline void updatePosteriorMinimum(__m128i *I2_block_addr,
-                                       const int32_t &d,
-                                       const __m128i &xmm1,
-                                       __m128i &xmm2,
-                                       int32_t &val,
-                                       int32_t &min_val,
-                                       int32_t &min_d);
     inline void findMatch(int32_t &u,
                           int32_t &v,
                           float &plane_a,
                           float &plane_b,
                           float &plane_c,
-                          int32_t *disparity_grid,
+                          uint64_t *disparity_grid,
                           int32_t *grid_dims,
                           uint8_t *I1_desc,
                           uint8_t *I2_desc,
@@ -229,9 +331,9 @@ class Elas {
                           bool &valid,
                           bool &right_image,
                           float *D);
-    void computeDisparity(std::vector<support_pt> p_support,
-                          std::vector<triangle> tri,
-                          int32_t *disparity_grid,
+    void computeDisparity(const std::vector<support_pt> &p_support,
+                          const std::vector<triangle> &tri,
+                          uint64_t *disparity_grid,
                           int32_t *grid_dims,
                           uint8_t *I1_desc,
                           uint8_t *I2_desc,
@@ -240,21 +342,77 @@ class Elas {
 
     // L/R consistency check
     void leftRightConsistencyCheck(float *D1, float *D2);
+    // checks row v, D1_copy and D2_copy receive the unchecked rows
+    void leftRightConsistencyCheckRow(float *D1, float *D2, float *D1_copy, float *D2_copy, int32_t v);
 
     // postprocessing
-    void removeSmallSegments(float *D);
+    void removeSmallSegments(float *D, bool right_image);
+    static constexpr int32_t segment_band = 32;  // rows per removeSmallSegments() task
+    // union-find of removeSmallSegments(), the root of a segment is its smallest pixel index
+    inline int32_t findSegment(int32_t *parent, int32_t i) {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    }
+    inline void mergeSegments(int32_t *parent, int32_t *size, int32_t a, int32_t b) {
+        a = findSegment(parent, a);
+        b = findSegment(parent, b);
+        if (a == b)
+            return;
+        if (a > b)
+            std::swap(a, b);
+        parent[b] = a;
+        size[a] += size[b];
+    }
+    // segments of the rows v_min to v_max - 1, joinSegments() connects such bands of band rows
+    void labelSegments(const float *D, int32_t *parent, int32_t *size, int32_t v_min, int32_t v_max);
+    void joinSegments(const float *D, int32_t *parent, int32_t *size, int32_t band);
+    void invalidateSmallSegments(const float *D, float *D_out, const int32_t *parent, const int32_t *size, int32_t v_min, int32_t v_max);
+
     void gapInterpolation(float *D);
+    void gapInterpolationRow(float *D, int32_t v);
+    // interpolates the column-wise gaps of D in the rows v_min to v_max - 1 and the columns u_min to
+    // u_max - 1 of D_out
+    static constexpr int32_t gap_column_block = 64;  // columns gapInterpolationColumns() walks through row by row
+    void gapInterpolationColumns(const float *D, float *D_out, int32_t v_min, int32_t v_max, int32_t u_min, int32_t u_max);
 
     // optional postprocessing
-    void adaptiveMean(float *D);
-    void median(float *D);
+    void adaptiveMean(float *D, bool right_image);
+    void adaptiveMeanHorizontal(const float *D, float *D_copy, float *D_tmp, int32_t v);
+    void adaptiveMeanVertical(const float *D_tmp, float *D, int32_t v);
+    void median(float *D, bool right_image);
+    void medianHorizontal(const float *D, float *D_temp, int32_t v);
+    void medianVertical(const float *D_temp, float *D, int32_t v);
+    void postProcess(float *D, bool right_image);
+
+    // L/R consistency check and postprocessing in row bands (param.postprocess_fused)
+    static constexpr int32_t postprocess_band = 64;  // rows per band
+    static constexpr int32_t postprocess_halo = 7;   // rows above and below a band read by adaptiveMean() and median()
+    void postProcessFused(float *D1, float *D2);
+    // column-wise gap interpolation and filters of the rows v_min to v_max - 1 (D_in: row-wise interpolated image)
+    void postProcessRows(const float *D_in, float *D, float *D_band, int32_t v_min, int32_t v_max);
+
+    // matches the images of the size dims (all of them or the crop around the region of interest)
+    void processImages(uint8_t *I1, uint8_t *I2, float *D1, float *D2, const int32_t *dims);
+    static constexpr int32_t roi_halo = 16;  // pixels around the region of interest which are matched as well
+    // moves the crop_width x crop_height disparities stored at the start of D to the column u_crop and the
+    // row v_crop of the D_width x D_height image and invalidates everything outside the region
+    // [region[0], region[2]) x [region[1], region[3]) (all in disparity image pixels)
+    void placeRegion(float *D, int32_t D_width, int32_t D_height, int32_t crop_width, int32_t crop_height, int32_t u_crop, int32_t v_crop,
+                     const int32_t *region);
 
     // parameter set
     parameters param;
 
-    // memory aligned input images + dimensions
-    uint8_t *I1, *I2;
-    int32_t width, height, bpl;
+    // disparity range per image row (setRowDisparityRange())
+    std::vector<int32_t> row_disp_min, row_disp_max;
+    const int32_t *row_min, *row_max;  // the ones of the rows processImages() matches (0: none)
+
+    // image dimensions
+    int32_t width, height;
+
+    // reusable buffers
+    workspace ws;
 
     // profiling timer
 #ifdef PROFILE
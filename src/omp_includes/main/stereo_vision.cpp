@@ -23,6 +23,10 @@
 #include "../../common_includes/bayesian/bayesian.h"
 #include "../../common_includes/graphing.h"
 #include "../../common_includes/image.h"
+#include "../../common_includes/pointcloud/box_statistics.h"
+#include "../../common_includes/pointcloud/depth_lut.h"
+#include "../../common_includes/pointcloud/reprojection.h"
+#include "../../common_includes/pointcloud/top_view.h"
 #include "../../common_includes/yolo/yolo.hpp"
 #include "../elas/elas.h"
 
@@ -62,6 +66,14 @@ Size calib_img_size;
 
 bool subsample = false;  // Allows for evaluating only every second pixel, which is often sufficient in robotics applications, since depth accuracy
                          // matters more than a large image domain.
+int temporal = 0;  // Warm-starts the support point matching of every frame from the previous one, only meaningful for video input
+int fused_postprocess = 0;  // Runs the post processing in cache sized row bands, the results are the same
+float min_depth = 0, max_depth = 0;  // Working depth range in the units of the calibration baseline (0: no limit), see findDisparityRange
+int disp_min = 0, disp_max = 255;    // Disparity range searched by LIBELAS, derived from the depth range
+int ground_margin = 0;  // Bounds the disparities of every row from below by the ground plane minus this margin (0: off), see findRowDisparityRange
+vector<int32_t> row_disp_min, row_disp_max;  // Disparity range of every image row searched by LIBELAS (empty: disp_min..disp_max)
+Rect valid_roi;       // Region in which both rectified images have valid pixels, see findRectificationMap
+int sky_removal = 0;  // Only matches the image below the sky, see belowSky
 float scale_factor = 1;  // Modify to change the image resize factor
 int point_cloud_extrapolation = 1;                       // Modify to change the point cloud extrapolation
 int input_image_width = 1242, input_image_height = 375;  // Default image size in the Kitti dataset
@@ -88,6 +100,19 @@ Grapher<Double3, Uchar4> *grapher;
 // Graphics
 int Oindex = 0;
 Double3 *points;  // Holds the coordinates of each pixel in 3D space
+Reprojection reprojection;  // Converts the disparity map to the points, see publishPointCloud
+int point_cloud_format = -1;              // Reprojection::Format returned by generatePointCloud (-1: binary, only the points above are computed)
+void *point_cloud;                        // The points in point_cloud_format, unless all of them are returned as points (XYZ_F64)
+bool point_cloud_compact = false;         // Only returns the points inside point_cloud_limits, without gaps
+Reprojection::Limits point_cloud_limits;  // Disparity and x, y, z ranges of the returned points
+int point_cloud_count = 0;                // Number of points returned by the last generatePointCloud
+TopView top_view;                         // Bird's eye view grid of the points, see setTopView
+bool top_view_enabled = false;
+BoxStatistics box_statistics;  // Summed area tables of the points, for the mean positions of the tracked objects
+int object_median = 1;         // Places every object at the median disparity of its box instead of the mean of its points
+DepthLut depth_lut;            // Converts the float disparities of LIBELAS to depth, see setDepthImage
+int depth_format = -1;         // DepthLut::Format of depth_image (-1: off)
+Mat depth_image;               // Depth of every pixel of the disparity map (CV_16UC1), 0 without a disparity
 ////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void Init() {
@@ -109,6 +134,7 @@ void clean() {
     if (graphicsBeingUsed)
         pthread_join(graphicsThread, NULL);
     free(points);
+    free(point_cloud);
     printf("\n\nProgram exitted successfully!\n\n");
     exit(0);
 }
@@ -189,6 +215,24 @@ string YOLO_to_KITTI_labels(string y) {
     return "Misc";
 }
 
+// XR as a 3x3 rotation matrix (CV_64F), the calibration may give it as a rotation vector like debug = 1 does, empty without XR
+Mat robotRotation() {
+    Mat rotation;
+    if (XR.total() == 3)
+        Rodrigues(XR, rotation);
+    else
+        XR.convertTo(rotation, CV_64F);
+    return rotation;
+}
+
+// Sets up the reprojection of width x height disparity maps into the robot frame (XR, XT)
+void initReprojection(int width, int height) {
+    Mat rotation = robotRotation(), translation;
+    XT.convertTo(translation, CV_64F);
+    bool robot_frame = rotation.total() == 9 && translation.total() == 3;
+    reprojection.init(Q.ptr<double>(0), robot_frame ? rotation.ptr<double>(0) : 0, robot_frame ? translation.ptr<double>(0) : 0, width, height);
+}
+
 /*
  * Function:  publishPointCloud
  * --------------------
@@ -215,6 +259,9 @@ string YOLO_to_KITTI_labels(string y) {
  *  0, 0, 0,                  455.4106857822576;
  *  0, 0, 1.861616069957151,  -0]
  *
+ * Both steps are folded into one 4x4 matrix by the Reprojection kernel (src/common_includes/pointcloud),
+ * which converts the disparity map row by row without allocations.
+ *
  *  Mat& img_left: The input left image - set of points (x, y)
  *  Mat& dmap: input disparity map d(x, y)
  *  returns: void
@@ -225,62 +272,83 @@ void publishPointCloud(const Mat &img_left_old, Mat &dmap_old) {
     Mat img_left, dmap;
     resize(img_left_old, img_left, Size(point_cloud_width, point_cloud_height));
     resize(dmap_old, dmap, Size(point_cloud_width, point_cloud_height));
-    int pointCloudCol;
-    Mat V = Mat(4, 1, CV_64FC1);
-    Mat pos = Mat(4, 1, CV_64FC1);
-
-    if (draw_points) {
+    if (reprojection.getWidth() != dmap.cols || reprojection.getHeight() != dmap.rows)
+        initReprojection(dmap.cols, dmap.rows);
+    if (draw_points || (objectTracking && !object_median) || (point_cloud_format == Reprojection::XYZ_F64 && !point_cloud_compact)) {
 #pragma omp parallel for
-        for (int j = 0; j < img_left.rows; j++) {
-            for (int i = 0; i < img_left.cols; ++i) {
-                int d = dmap.at<uchar>(j, i);
-                // V is the vector to be multiplied to Q to get
-                // the 3D homogenous coordinates of the image point
-                V.at<double>(0, 0) = (double)(i);
-                V.at<double>(1, 0) = (double)(j);
-                V.at<double>(2, 0) = (double)d;
-                V.at<double>(3, 0) = 1.;
-
-                pos = Q * V;  // 3D homogeneous coordinate
-                double X = pos.at<double>(0, 0) / pos.at<double>(3, 0);
-                double Y = pos.at<double>(1, 0) / pos.at<double>(3, 0);
-                double Z = pos.at<double>(2, 0) / pos.at<double>(3, 0);
-                Mat point3d_cam = Mat(3, 1, CV_64FC1);
-                point3d_cam.at<double>(0, 0) = X;
-                point3d_cam.at<double>(1, 0) = Y;
-                point3d_cam.at<double>(2, 0) = Z;
-                // transform 3D point from camera frame to robot frame
-                // Mat point3d_robot = XR * point3d_cam + XT;
-                // points.push_back(Point3d(point3d_robot));
-                // ch.values.push_back(*reinterpret_cast<float*>(&rgb));
-                points[j * out_width + i].x = X;
-                points[j * out_width + i].y = Y;
-                points[j * out_width + i].z = Z;
-            }
-        }
+        for (int j = 0; j < dmap.rows; j++)
+            reprojection.reprojectRows(dmap.ptr<uchar>(0), dmap.step, (double *)points, j, j + 1);
+    }
+    point_cloud_count = dmap.rows * dmap.cols;
+    if (point_cloud_compact) {
+        // every row is compacted in place, then the rows are moved together
+        static vector<int32_t> row_counts;
+        row_counts.resize(dmap.rows);
+#pragma omp parallel for
+        for (int j = 0; j < dmap.rows; j++)
+            row_counts[j] = reprojection.reprojectRowsCompact(dmap.ptr<uchar>(0), dmap.step, point_cloud, j, j + 1, point_cloud_limits,
+                                                              (Reprojection::Format)point_cloud_format);
+        point_cloud_count = reprojection.packRows(point_cloud, row_counts.data(), (Reprojection::Format)point_cloud_format);
+    } else if (point_cloud_format > Reprojection::XYZ_F64) {
+#pragma omp parallel for
+        for (int j = 0; j < dmap.rows; j++)
+            reprojection.reprojectRows(dmap.ptr<uchar>(0), dmap.step, point_cloud, j, j + 1, (Reprojection::Format)point_cloud_format);
+    }
+    if (top_view_enabled) {
+        // one partial grid per thread, merged at the end
+        top_view.begin(reprojection, omp_get_max_threads());
+#pragma omp parallel for
+        for (int j = 0; j < dmap.rows; j++)
+            top_view.accumulate(reprojection, dmap.ptr<uchar>(0), dmap.step, j, j + 1, omp_get_thread_num());
+        top_view.finish();
     }
 
-    if (objectTracking) {
+    if (objectTracking && !obj_list.empty()) {
+        // the mean point of a box comes from summed area tables, the median disparity from a histogram of the box
+        if (!object_median) {
+            if (box_statistics.getWidth() != dmap.cols || box_statistics.getHeight() != dmap.rows)
+                box_statistics.init(dmap.cols, dmap.rows);
+#pragma omp parallel for
+            for (int j = 0; j < dmap.rows; j++)
+                box_statistics.sumRows(dmap.ptr<uchar>(0), dmap.step, (double *)points, j, j + 1);
+#pragma omp parallel for
+            for (int i = 0; i < dmap.cols; i += 64)
+                box_statistics.sumColumns(i, min(i + 64, dmap.cols));
+        }
+        // the boxes are in the pixels of the images given to YOLO (the size of dmap_old), the bounds in dmap are exclusive
+        double scale_u = (double)dmap.cols / dmap_old.cols, scale_v = (double)dmap.rows / dmap_old.rows;
         for (auto &object : obj_list) {
-            int i_lb = constrain(object.x, 0, img_left.cols - 1), i_ub = constrain(object.x + object.w, 0, img_left.cols - 1),
-                j_lb = constrain(object.y, 0, img_left.rows - 1), j_ub = constrain(object.y + object.h, 0, img_left.rows - 1);
-            double X = 0, Y = 0, Z = 0;
-
-            for (int i = i_lb; i < i_ub; i++) {
-                for (int j = j_lb; j < j_ub; ++j) {
-                    X += points[j * out_width + i].x;
-                    Y += points[j * out_width + i].y;
-                    Z += points[j * out_width + i].z;
-                }
-            }
+            int i_lb = constrain((int)floor(object.x * scale_u), 0, dmap.cols), i_ub = constrain((int)ceil((object.x + object.w) * scale_u), 0, dmap.cols),
+                j_lb = constrain((int)floor(object.y * scale_v), 0, dmap.rows), j_ub = constrain((int)ceil((object.y + object.h) * scale_v), 0, dmap.rows);
+            if (i_lb >= i_ub || j_lb >= j_ub)
+                continue;
+            double xyz[3];
+            if (object_median) {
+                // the center of the box at the median disparity, which the background around the object does not shift
+                double d = BoxStatistics::medianDisparity(dmap.ptr<uchar>(0), dmap.step, i_lb, j_lb, i_ub, j_ub);
+                if (d < 0)
+                    continue;
+                reprojection.reprojectPoint((i_lb + i_ub - 1) / 2, (j_lb + j_ub - 1) / 2, d, xyz);
+            } else if (!box_statistics.mean(i_lb, j_lb, i_ub, j_ub, xyz))
+                continue;
             if (graphicsBeingUsed)
-                grapher->appendOBJECTS(X / ((i_ub - i_lb) * (j_ub - j_lb)), Y / ((i_ub - i_lb) * (j_ub - j_lb)), Z / ((i_ub - i_lb) * (j_ub - j_lb)),
-                                       object.r, object.g, object.b);
+                grapher->appendOBJECTS(xyz[0], xyz[1], xyz[2], object.r, object.g, object.b);
         }
     }
     end_timer(pc_start, pc_t);
 }
 
+// The lower part of an image of the size s, without the sky in the upper 55 % of the rows
+Rect belowSky(Size s) {
+    int sky_height = s.height / 2 * 1.1;
+    return Rect(0, sky_height, s.width, s.height - sky_height);
+}
+
+// Sets up the conversion of the LIBELAS disparities to depth in the given format, with the Q matrix of findRectificationMap
+void initDepthLut(DepthLut::Format format) {
+    depth_lut.init(Q.at<double>(2, 3), Q.at<double>(3, 2), Q.at<double>(3, 3), disp_max, format);
+}
+
 /*
  * Function:  generateDisparityMap
  * --------------------
@@ -303,19 +371,52 @@ Mat generateDisparityMap(Mat &left, Mat &right) {
     }
     const Size imsize = left.size();
     const int32_t dims[3] = {imsize.width, imsize.height, imsize.width};
-    Mat leftdpf = Mat::zeros(imsize, CV_32F);
-    Mat rightdpf = Mat::zeros(imsize, CV_32F);
 
     static Elas::parameters param(Elas::MIDDLEBURY);  // param(Elas::ROBOTICS);
     static int res =
-        printf("Post Process only left = %d, Subsampling = %d\n", param.postprocess_only_left = true, param.subsampling = subsample);  // false;
+        printf("Post Process only left = %d, Subsampling = %d, Temporal = %d, Fused Post Processing = %d, Disparity Range = %d..%d\n",
+               param.postprocess_only_left = true, param.subsampling = subsample, param.temporal = temporal, param.postprocess_fused = fused_postprocess,
+               param.disp_min = disp_min, param.disp_max = disp_max);  // false;
     param.filter_adaptive_mean = true;
     static Elas elas(param);
-
-    elas.process(left.data, right.data, leftdpf.ptr<float>(0), rightdpf.ptr<float>(0), dims);
+    // generatePointCloud passes subsampling and the video mode with every frame
+    if (param.subsampling != subsample || param.temporal != (bool)temporal) {
+        param.subsampling = subsample;
+        param.temporal = temporal;
+        elas.setParameters(param);
+    }
+    [[maybe_unused]] static bool row_range = (elas.setRowDisparityRange(row_disp_min.data(), row_disp_max.data(), row_disp_min.size()), true);
+
+    // with subsampling only every second pixel of every second line gets a disparity
+    const Size dsize = param.subsampling ? Size(imsize.width / 2, imsize.height / 2) : imsize;
+    Mat leftdpf = Mat::zeros(dsize, CV_32F);
+    Mat rightdpf = Mat::zeros(dsize, CV_32F);
+
+    // LIBELAS only matches the region of interest (and a margin around it), the rest stays invalid
+    Rect roi = Rect(Point(0, 0), imsize);
+    if (!valid_roi.empty())
+        roi &= valid_roi;
+    if (sky_removal)
+        roi &= belowSky(imsize);
+    const int32_t roi_rect[4] = {roi.x, roi.y, roi.width, roi.height};
+    elas.process(left.data, right.data, leftdpf.ptr<float>(0), rightdpf.ptr<float>(0), dims, roi_rect);
+    if (depth_format >= 0) {
+        // from the float disparities, before they are quantized to the 8 bit disparity map
+        if (depth_lut.getFormat() != depth_format)
+            initDepthLut((DepthLut::Format)depth_format);
+        depth_image.create(dsize, CV_16UC1);
+#pragma omp parallel for
+        for (int j = 0; j < dsize.height; j++)
+            depth_lut.convertRows(leftdpf.ptr<float>(0), depth_image.ptr<uint16_t>(0), dsize.width, j, j + 1);
+    }
     static Mat dmap = Mat(out_img_size, CV_8UC1, Scalar(0));
 
-    leftdpf.convertTo(dmap, CV_8UC1, 4.0);
+    if (param.subsampling) {
+        static Mat dmap_half;
+        leftdpf.convertTo(dmap_half, CV_8UC1, 4.0);
+        resize(dmap_half, dmap, imsize, 0, 0, INTER_NEAREST);
+    } else
+        leftdpf.convertTo(dmap, CV_8UC1, 4.0);
     return dmap;
 }
 
@@ -439,6 +540,7 @@ void findRectificationMap(FileStorage &calib_file, Size finalSize) {
     */
 
     stereoRectify(K1, D1, K2, D2, calib_img_size, R, Mat(T), R1, R2, P1, P2, Q, CALIB_ZERO_DISPARITY, 0, finalSize, &validRoi[0], &validRoi[1]);
+    valid_roi = validRoi[0] & validRoi[1];
 
     // P1 = (Mat_<double>(3,4) << 7.215377000000e+02, 0.000000000000e+00, 6.095593000000e+02, 4.485728000000e+01,
     // 0.000000000000e+00, 7.215377000000e+02, 1.728540000000e+02, 2.163791000000e-01, 0.000000000000e+00,
@@ -483,12 +585,85 @@ void findRectificationMap(FileStorage &calib_file, Size finalSize) {
     cout << "Done rectification" << endl;
 }
 
-Mat remove_sky(Mat frame) {
-    static Size s = frame.size();
-    static Mat sky_mask = cv::Mat::ones(s, CV_8UC1);
-    static unsigned height = s.height / 2 * 1.1;
-    sky_mask(Rect(0, 0, s.width, height)) = 0;
-    return sky_mask;
+/*
+ * Function:  findDisparityRange
+ * --------------------
+ * This function derives the disparity range LIBELAS searches (disp_min, disp_max) from the working
+ * depth range [min_depth, max_depth] and the Q matrix computed by findRectificationMap. A depth Z
+ * is seen at the disparity d = (f / Z - Q(3,3)) / Q(3,2), where f = Q(2,3) is the focal length and
+ * Q(3,2) = -1/Tx the inverse baseline, both at the output image size (i.e. after scale_factor).
+ * Points closer than min_depth get no disparity at all.
+ *
+ *  returns: void
+ *
+ */
+void findDisparityRange() {
+    disp_min = 0;
+    disp_max = 255;
+    double f = Q.at<double>(2, 3), inverse_baseline = Q.at<double>(3, 2), offset = Q.at<double>(3, 3);
+    if (f <= 0 || inverse_baseline <= 0) {
+        printf("Disparity range: no valid focal length and baseline in Q, using %d..%d\n", disp_min, disp_max);
+        return;
+    }
+    auto disparity = [&](double depth) { return min((f / depth - offset) / inverse_baseline, 255.0); };
+    if (max_depth > 0)
+        disp_min = constrain((int)floor(disparity(max_depth)), 0, 255);
+    if (min_depth > 0)
+        disp_max = constrain((int)ceil(disparity(min_depth)), 0, 255);
+    // LIBELAS needs at least 10 disparities to accept a support point
+    disp_max = constrain(disp_max, min(disp_min + 10, 255), 255);
+    disp_min = min(disp_min, disp_max - 10);
+    printf("Disparity range for depths %.2f..%.2f: %d..%d\n", min_depth, max_depth, disp_min, disp_max);
+}
+
+/*
+ * Function:  findRowDisparityRange
+ * --------------------
+ * On a vehicle no point of the scene lies below the ground, the plane z = 0 of the robot frame
+ * (XR, XT). The ray of a pixel below the horizon therefore ends on the ground at the latest, which
+ * bounds the disparities of its image row from below. In the rectified left camera frame the up
+ * axis of the robot is n = R1 * (third row of XR)^T and the camera is XT(2) above the ground, so
+ * the ray r = ((u - Cx) / f, (v - Cy) / f, 1) meets the ground at the depth Z = -XT(2) / (n . r).
+ * Every row gets the smallest ground disparity of its columns (n . r is linear in u, so one of the
+ * border columns) minus ground_margin, which absorbs pitching, slopes and calibration errors. Rows
+ * at or above the horizon keep disp_min. The ground gives no upper bound, since an obstacle close
+ * to the camera may cover any row, so every row keeps disp_max.
+ *
+ *  const char *calibration: The calibration file XR and XT were read from (for the messages)
+ *  returns: void
+ *
+ */
+void findRowDisparityRange(const char *calibration) {
+    row_disp_min.clear();
+    row_disp_max.clear();
+    if (ground_margin <= 0)
+        return;
+    double f = Q.at<double>(2, 3), inverse_baseline = Q.at<double>(3, 2), offset = Q.at<double>(3, 3);
+    double cx = -Q.at<double>(0, 3), cy = -Q.at<double>(1, 3);
+    double camera_height = XT.empty() ? 0 : XT.at<double>(2, 0);
+    Mat rotation = robotRotation();
+    if (f <= 0 || inverse_baseline <= 0 || camera_height <= 0 || rotation.total() != 9) {
+        printf("Ground prior: no camera height above the ground in XT or no rotation XR in %s, disabled\n", calibration);
+        return;
+    }
+    Mat n = R1 * rotation.row(2).t();
+    n /= norm(n);
+
+    row_disp_min.assign(out_height, disp_min);
+    row_disp_max.assign(out_height, disp_max);
+    int horizon = out_height;
+    for (int v = out_height - 1; v >= 0; v--) {
+        double n_r = -HUGE_VAL;
+        for (int u : {0, out_width - 1})
+            n_r = max(n_r, (n.at<double>(0, 0) * (u - cx) + n.at<double>(1, 0) * (v - cy)) / f + n.at<double>(2, 0));
+        if (n_r >= 0)
+            break;
+        double d_ground = (-f * n_r / camera_height - offset) / inverse_baseline;
+        row_disp_min[v] = constrain((int)floor(d_ground) - ground_margin, disp_min, disp_max);
+        horizon = v;
+    }
+    printf("Ground prior: camera %.2f above the ground, rows %d..%d start at disparities %d..%d\n", camera_height, horizon, out_height - 1,
+           row_disp_min[min(horizon, out_height - 1)], row_disp_min[out_height - 1]);
 }
 
 void *startGraphicsThread(void *grapher) {
@@ -508,8 +683,14 @@ int externalInit(int width,
                  const char *YOLO_CFG,
                  const char *YOLO_WEIGHTS,
                  const char *YOLO_CLASSES,
-                 char *CAMERA_CALIBRATION_YAML) {
+                 char *CAMERA_CALIBRATION_YAML,
+                 float minDepth = 0,
+                 float maxDepth = 0,
+                 int groundMargin = 0) {
     scale_factor = scale;
+    min_depth = minDepth;
+    max_depth = maxDepth;
+    ground_margin = groundMargin;
     point_cloud_extrapolation = pc_extrapolation;
     draw_points = graphics;
     out_height = height;
@@ -547,7 +728,10 @@ int externalInit(int width,
     } else
         printf("\n** Display disabled\n");
     findRectificationMap(calib_file, out_img_size);
+    findDisparityRange();
+    findRowDisparityRange(CAMERA_CALIBRATION_YAML);
     Init();
+    point_cloud = malloc(Reprojection::pointSize(Reprojection::XYZ_F64) * point_cloud_width * point_cloud_height);  // largest format
     if (graphics) {
         printf("\n** 3D plotting enabled\n");
         grapher = new Grapher<Double3, Uchar4>(points);
@@ -563,28 +747,48 @@ int externalInit(int width,
     return 1;
 }
 
-// Returns the Double3 points array
+// Returns the points in the Reprojection::Format pointFormat: point_cloud_width * point_cloud_height Double3 (XYZ_F64), float
+// (XYZ_F32) or half float (XYZ_F16) triples, or the x, y and z planes of floats (PLANES_F32)
+// With pointRange (x_min, x_max, y_min, y_max, z_min, z_max, exclusive) or minDisparity (smallest value of the disparity map,
+// 4 per pixel of disparity) only the points inside are returned, without gaps, see getPointCount
 extern "C" {  // This function is exposed in the shared library along with the main function
-Double3 *generatePointCloud(uchar *left,
-                            uchar *right,
-                            char *CAMERA_CALIBRATION_YAML,
-                            int width,
-                            int height,
-                            bool kittiCalibration = true,
-                            bool objectTracking = false,
-                            bool graphics = false,
-                            bool display = false,
-                            int scale = 1,
-                            int pc_extrapolation = 1,
-                            const char *YOLO_CFG = "src/yolo/yolov4-tiny.cfg",
-                            const char *YOLO_WEIGHTS = "",
-                            const char *YOLO_CLASSES = "",
-                            bool removeSky = false,
-                            bool subsampling = false) {
+void *generatePointCloud(uchar *left,
+                         uchar *right,
+                         char *CAMERA_CALIBRATION_YAML,
+                         int width,
+                         int height,
+                         bool kittiCalibration = true,
+                         bool objectTracking = false,
+                         bool graphics = false,
+                         bool display = false,
+                         int scale = 1,
+                         int pc_extrapolation = 1,
+                         const char *YOLO_CFG = "src/yolo/yolov4-tiny.cfg",
+                         const char *YOLO_WEIGHTS = "",
+                         const char *YOLO_CLASSES = "",
+                         bool removeSky = false,
+                         bool subsampling = false,
+                         bool temporalMode = false,
+                         float minDepth = 0,
+                         float maxDepth = 0,
+                         int groundMargin = 0,
+                         int pointFormat = Reprojection::XYZ_F64,
+                         const float *pointRange = 0,
+                         int minDisparity = 0) {
     static int init = externalInit(width, height, kittiCalibration, graphics, display, objectTracking, scale, point_cloud_extrapolation, YOLO_CFG,
-                                   YOLO_WEIGHTS, YOLO_CLASSES, CAMERA_CALIBRATION_YAML);
+                                   YOLO_WEIGHTS, YOLO_CLASSES, CAMERA_CALIBRATION_YAML, minDepth, maxDepth, groundMargin);
 
     subsample = subsampling;
+    temporal = temporalMode;
+    sky_removal = removeSky;
+    point_cloud_format = pointFormat;
+    point_cloud_compact = pointRange || minDisparity > 0;
+    point_cloud_limits = Reprojection::Limits();
+    point_cloud_limits.d_min = minDisparity;
+    for (int k = 0; pointRange && k < 3; k++) {
+        point_cloud_limits.min[k] = pointRange[2 * k];
+        point_cloud_limits.max[k] = pointRange[2 * k + 1];
+    }
     start_timer(t_start);
     Mat left_img(Size(width, height), CV_8UC4, left);
     Mat right_img(Size(width, height), CV_8UC4, right);
@@ -603,10 +807,6 @@ Double3 *generatePointCloud(uchar *left,
         obj_list.insert(obj_list.end(), pred_list.begin(), pred_list.end());
     } else {
         imgCallback_video();
-        if (removeSky) {
-            Mat sky_mask = remove_sky(YOLOL_Color);
-            dmapOLD.copyTo(dmapOLD, sky_mask);
-        }
     }
     publishPointCloud(left_img_OLD, dmapOLD);
 
@@ -621,7 +821,37 @@ Double3 *generatePointCloud(uchar *left,
         waitKey(1);
     }
     printf("(FPS=%f) (%d, %d) (t_t=%f, dmap_t=%f, pc_t=%f)\n", 1 / t_t, dmapOLD.rows, dmapOLD.cols, t_t, dmap_t, pc_t);
-    return points;
+    return point_cloud_format == Reprojection::XYZ_F64 && !point_cloud_compact ? (void *)points : point_cloud;
+}
+
+// Number of points returned by the last generatePointCloud
+int getPointCount() {
+    return point_cloud_count;
+}
+
+// Converts the disparities of every following generatePointCloud to a depth image in the DepthLut::Format format (-1: off)
+void setDepthImage(int format) {
+    depth_format = format;
+}
+
+// The depth image of the last generatePointCloud, width x height 16 bit values, overwritten by the next one
+uint16_t *getDepthImage(int *width, int *height) {
+    *width = depth_image.cols;
+    *height = depth_image.rows;
+    return depth_image.ptr<uint16_t>(0);
+}
+
+// Rasterizes the points of every following generatePointCloud into a bird's eye view grid, see TopView::init
+void setTopView(const float *xRange, const float *yRange, const float *zRange, float scale, float hitProbability) {
+    top_view.init(xRange, yRange, zRange, scale, hitProbability);
+    top_view_enabled = true;
+}
+
+// The TopView::LAYERS x rows x cols grid of the last generatePointCloud, overwritten by the next one
+float *getTopView(int *rows, int *cols) {
+    *rows = top_view.getRows();
+    *cols = top_view.getCols();
+    return top_view.getGrid();
 }
 
 Uchar4 *getColor() {
@@ -711,20 +941,24 @@ void runProfiling(String file_1, String file_2) {
     int32_t width = I1->width();
     int32_t height = I1->height();
 
-    // Allocate memory for disparity images
+    // Allocate memory for disparity images (half size with subsampling)
     const int32_t dims[3] = {width, height, width};  // bytes per line = width
-    float *D1_data = (float *)malloc(width * height * sizeof(float));
-    float *D2_data = (float *)malloc(width * height * sizeof(float));
+    int32_t D_width = subsample ? width / 2 : width;
+    int32_t D_height = subsample ? height / 2 : height;
+    float *D1_data = (float *)malloc(D_width * D_height * sizeof(float));
+    float *D2_data = (float *)malloc(D_width * D_height * sizeof(float));
 
     // Process
     Elas::parameters param;
     param.postprocess_only_left = false;
+    param.subsampling = subsample;
+    param.postprocess_fused = fused_postprocess;
     Elas elas(param);
     elas.process(I1->data, I2->data, D1_data, D2_data, dims);
 
     // Find maximum disparity for scaling output disparity images to [0..255]
     float disp_max = 0;
-    for (int32_t i = 0; i < width * height; i++) {
+    for (int32_t i = 0; i < D_width * D_height; i++) {
         if (D1_data[i] > disp_max)
             disp_max = D1_data[i];
         if (D2_data[i] > disp_max)
@@ -732,9 +966,9 @@ void runProfiling(String file_1, String file_2) {
     }
 
     // Copy float to uchar
-    image<uchar> *D1 = new image<uchar>(width, height);
-    image<uchar> *D2 = new image<uchar>(width, height);
-    for (int32_t i = 0; i < width * height; i++) {
+    image<uchar> *D1 = new image<uchar>(D_width, D_height);
+    image<uchar> *D2 = new image<uchar>(D_width, D_height);
+    for (int32_t i = 0; i < D_width * D_height; i++) {
         D1->data[i] = (uint8_t)max(255.0 * D1_data[i] / disp_max, 0.0);
         D2->data[i] = (uint8_t)max(255.0 * D2_data[i] / disp_max, 0.0);
     }
@@ -760,6 +994,8 @@ int main(int argc, const char **argv) {
     ios_base::sync_with_stdio(false);
     static struct poptOption options[] = {
         {"kitti_path", 'k', POPT_ARG_STRING, &kitti_path, 0, "Path to KITTI Dataset", "STR"},
+        {"calibration", 'c', POPT_ARG_STRING, &calib_file_name, 0,
+         "Stereo calibration file (default data/calibration/kitti_2011_09_26.yml, data/kitti_2011_09_26.yml adds the ground plane for g)", "STR"},
         {"subsampling", 's', POPT_ARG_INT, &subsample, 0, "Set s=1 for evaluating only every second pixel", "NUM"},
         {"video_mode", 'v', POPT_ARG_INT, &video_mode, 0, "Set v=1 Kitti video mode", "NUM"},
         {"draw_points", 'p', POPT_ARG_SHORT, &draw_points, 0, "Set p=1 to plot out points", "NUM"},
@@ -774,6 +1010,16 @@ int main(int argc, const char **argv) {
         {"scale_factor", 'f', POPT_ARG_FLOAT, &scale_factor, 0, "All operations will be applied after shrinking the image by this factor", "NUM"},
         {"extrapolate_point_cloud", 'e', POPT_ARG_INT, &point_cloud_extrapolation, 0, "Extrapolate the point cloud by this factor", "NUM"},
         {"profile", 'P', POPT_ARG_INT, &profile, 0, "Profile", "NUM"},
+        {"temporal", 'T', POPT_ARG_INT, &temporal, 0, "Set T=1 to warm-start the support matching of every frame from the previous one", "NUM"},
+        {"min_depth", 'n', POPT_ARG_FLOAT, &min_depth, 0, "Nearest depth (meters for KITTI) that needs a disparity, limits the disparity search (0: no limit)",
+         "NUM"},
+        {"max_depth", 'm', POPT_ARG_FLOAT, &max_depth, 0, "Farthest depth that needs a disparity, limits the disparity search (0: no limit)", "NUM"},
+        {"ground_margin", 'g', POPT_ARG_INT, &ground_margin, 0,
+         "Set g=N to search no disparities below the ground plane of the calibration (XR, XT) minus N in every row (0: off)", "NUM"},
+        {"remove_sky", 'r', POPT_ARG_INT, &sky_removal, 0, "Set r=1 to only match the lower 45 % of the image, below the sky", "NUM"},
+        {"object_median", 'o', POPT_ARG_INT, &object_median, 0,
+         "Set o=0 to place tracked objects at the mean of the points in their box instead of the box center at the median disparity", "NUM"},
+        {"fused_postprocess", 'F', POPT_ARG_INT, &fused_postprocess, 0, "Set F=1 to run the post processing in cache sized row bands (same results)", "NUM"},
         POPT_AUTOHELP{NULL, 0, 0, NULL, 0, NULL, NULL}};
     poptContext poptCONT = poptGetContext("main", argc, argv, options, POPT_CONTEXT_KEEP_FIRST);
     if (argc < 2) {
@@ -828,6 +1074,8 @@ int main(int argc, const char **argv) {
              << "\n P2 : " << P2 << '\n';
 
         findRectificationMap(calib_file, out_img_size);
+        findDisparityRange();
+        findRowDisparityRange(calib_file_name);
         Init();
         if (draw_points) {
             grapher = new Grapher<Double3, Uchar4>(points);
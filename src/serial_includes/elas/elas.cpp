@@ -22,57 +22,123 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 #include "elas.h"
 #include <math.h>
 #include <algorithm>
+#include <numeric>
 #include "../../common_includes/elas/descriptor.h"
-#include "../../common_includes/elas/matrix.h"
-#include "../../common_includes/elas/triangle.h"
+#include "../../common_includes/elas/filter.h"
+#include "../../common_includes/elas/matching.h"
+#ifdef PROFILE
+#include <sys/resource.h>
+#endif
 
 using namespace std;
 
-void Elas::process(uint8_t *I1_, uint8_t *I2_, float *D1, float *D2, const int32_t *dims) {
-    // get width, height and bytes per line
-    width = dims[0];
-    height = dims[1];
-    bpl = width + 15 - (width - 1) % 16;
-
-    // copy images to byte aligned memory
-    I1 = (uint8_t *)_mm_malloc(bpl * height * sizeof(uint8_t), 16);
-    I2 = (uint8_t *)_mm_malloc(bpl * height * sizeof(uint8_t), 16);
-    memset(I1, 0, bpl * height * sizeof(uint8_t));
-    memset(I2, 0, bpl * height * sizeof(uint8_t));
-    if (bpl == dims[2]) {
-        memcpy(I1, I1_, bpl * height * sizeof(uint8_t));
-        memcpy(I2, I2_, bpl * height * sizeof(uint8_t));
-    } else {
-        for (int32_t v = 0; v < height; v++) {
-            memcpy(I1 + v * bpl, I1_ + v * dims[2], width * sizeof(uint8_t));
-            memcpy(I2 + v * bpl, I2_ + v * dims[2], width * sizeof(uint8_t));
+void Elas::process(uint8_t *I1, uint8_t *I2, float *D1, float *D2, const int32_t *dims, const int32_t *roi) {
+    // bounded disparity range of the image rows (setRowDisparityRange())
+    bool row_bounds = (int32_t)row_disp_min.size() == dims[1];
+    row_min = row_bounds ? row_disp_min.data() : 0;
+    row_max = row_bounds ? row_disp_max.data() : 0;
+
+    // region of interest, clipped to the image
+    int32_t u_min = 0, v_min = 0, u_max = dims[0], v_max = dims[1];
+    if (roi) {
+        u_min = max(roi[0], 0);
+        v_min = max(roi[1], 0);
+        u_max = min(roi[0] + roi[2], dims[0]);
+        v_max = min(roi[1] + roi[3], dims[1]);
+    }
+    if (u_min == 0 && v_min == 0 && u_max == dims[0] && v_max == dims[1]) {
+        processImages(I1, I2, D1, D2, dims);
+        return;
+    }
+
+    // with subsampling the disparity image has every second pixel of every second line
+    int32_t step = param.subsampling ? 2 : 1;
+    int32_t D_width = dims[0] / step;
+    int32_t D_height = dims[1] / step;
+    if (u_max <= u_min || v_max <= v_min) {
+        std::fill(D1, D1 + D_width * D_height, -1.0f);
+        std::fill(D2, D2 + D_width * D_height, -1.0f);
+        return;
+    }
+
+    // only match the crop around the region: the halo gives the support points, the triangulation and
+    // the filters context at its border, the disparity range left of it holds the pixels of the right
+    // image the region matches to. Its origin keeps the support point candidates, the disparity grid
+    // cells and the subsampled pixels at the same places as in the whole image.
+    int32_t align = std::lcm(std::lcm(param.candidate_stepsize, param.grid_size), 2);
+    int32_t u_crop = max(u_min - param.disp_max - roi_halo, 0) / align * align;
+    int32_t v_crop = max(v_min - roi_halo, 0) / align * align;
+    const int32_t dims_crop[3] = {min(u_max + roi_halo, dims[0]) - u_crop, min(v_max + roi_halo, dims[1]) - v_crop, dims[2]};
+    if (row_bounds) {
+        row_min += v_crop;
+        row_max += v_crop;
+    }
+    processImages(I1 + v_crop * dims[2] + u_crop, I2 + v_crop * dims[2] + u_crop, D1, D2, dims_crop);
+
+    // the disparities of the crop fill the start of D1 and D2, move them to their place in the image
+    const int32_t region[4] = {(u_min + step - 1) / step, (v_min + step - 1) / step, min((u_max + step - 1) / step, D_width),
+                               min((v_max + step - 1) / step, D_height)};
+    placeRegion(D1, D_width, D_height, dims_crop[0] / step, dims_crop[1] / step, u_crop / step, v_crop / step, region);
+    placeRegion(D2, D_width, D_height, dims_crop[0] / step, dims_crop[1] / step, u_crop / step, v_crop / step, region);
+}
+
+void Elas::placeRegion(float *D, int32_t D_width, int32_t D_height, int32_t crop_width, int32_t crop_height, int32_t u_crop, int32_t v_crop,
+                       const int32_t *region) {
+    // every row moves towards the end of D, from the last row to the first one no row overwrites one still to be moved
+    for (int32_t v = crop_height - 1; v >= 0; v--)
+        memmove(D + getAddressOffsetImage(u_crop, v_crop + v, D_width), D + getAddressOffsetImage(0, v, crop_width), crop_width * sizeof(float));
+
+    for (int32_t v = 0; v < D_height; v++) {
+        float *D_line = D + getAddressOffsetImage(0, v, D_width);
+        if (v < region[1] || v >= region[3]) {
+            std::fill(D_line, D_line + D_width, -1.0f);
+        } else {
+            std::fill(D_line, D_line + region[0], -1.0f);
+            std::fill(D_line + region[2], D_line + D_width, -1.0f);
         }
     }
+}
+
+void Elas::processImages(uint8_t *I1, uint8_t *I2, float *D1, float *D2, const int32_t *dims) {
+    // get width and height
+    width = dims[0];
+    height = dims[1];
+
+    // (re)build the workspace if the image size or the parameters changed
+    if (!ws.valid || ws.width != width || ws.height != height)
+        allocateWorkspace();
 
 #ifdef PROFILE
     timer.start("Descriptor");
 #endif
-    Descriptor desc1(I1, width, height, bpl, param.subsampling);
-    Descriptor desc2(I2, width, height, bpl, param.subsampling);
+    // the descriptors copy the image rows they filter to byte aligned memory themselves and only
+    // keep the rows the matching reads (every second one for subsampling)
+    Descriptor &desc1 = ws.desc1, &desc2 = ws.desc2;
+    desc1.compute(I1, width, height, dims[2], param.subsampling, param.subsampling);
+    desc2.compute(I2, width, height, dims[2], param.subsampling, param.subsampling);
 
 #ifdef PROFILE
     timer.start("Support Matches");
 #endif
-    vector<support_pt> p_support = computeSupportMatches(desc1.I_desc, desc2.I_desc);
+    vector<support_pt> &p_support = ws.p_support;
+    computeSupportMatches(desc1.I_desc, desc2.I_desc, p_support);
 
     // if not enough support points for triangulation
     if (p_support.size() < 3) {
         cout << "ERROR: Need at least 3 support points!" << endl;
-        _mm_free(I1);
-        _mm_free(I2);
+        // no disparities, D1 and D2 must not keep what the caller left there (placeRegion moves them)
+        int32_t D_size = param.subsampling ? (width / 2) * (height / 2) : width * height;
+        std::fill(D1, D1 + D_size, -1.0f);
+        std::fill(D2, D2 + D_size, -1.0f);
         return;
     }
 
+    vector<triangle> &tri_1 = ws.tri_1, &tri_2 = ws.tri_2;
 #ifdef PROFILE
     timer.start("Delaunay Triangulation");
 #endif
-    vector<triangle> tri_1 = computeDelaunayTriangulation(p_support, 0);
-    vector<triangle> tri_2 = computeDelaunayTriangulation(p_support, 1);
+    computeDelaunayTriangulation(p_support, 0, tri_1);
+    computeDelaunayTriangulation(p_support, 1, tri_2);
 
 #ifdef PROFILE
     timer.start("Disparity Planes");
@@ -84,12 +150,10 @@ void Elas::process(uint8_t *I1_, uint8_t *I2_, float *D1, float *D2, const int32
     timer.start("Grid");
 #endif
 
-    // allocate memory for disparity grid
-    int32_t grid_width = (int32_t)ceil((float)width / (float)param.grid_size);
-    int32_t grid_height = (int32_t)ceil((float)height / (float)param.grid_size);
-    int32_t grid_dims[3] = {param.disp_max + 2, grid_width, grid_height};
-    int32_t *disparity_grid_1 = (int32_t *)calloc((param.disp_max + 2) * grid_height * grid_width, sizeof(int32_t));
-    int32_t *disparity_grid_2 = (int32_t *)calloc((param.disp_max + 2) * grid_height * grid_width, sizeof(int32_t));
+    // disparity grid
+    int32_t *grid_dims = ws.grid_dims;
+    uint64_t *disparity_grid_1 = ws.disparity_grid_1;
+    uint64_t *disparity_grid_2 = ws.disparity_grid_2;
 
     createGrid(p_support, disparity_grid_1, grid_dims, 0);
     createGrid(p_support, disparity_grid_2, grid_dims, 1);
@@ -100,53 +164,196 @@ void Elas::process(uint8_t *I1_, uint8_t *I2_, float *D1, float *D2, const int32
     computeDisparity(p_support, tri_1, disparity_grid_1, grid_dims, desc1.I_desc, desc2.I_desc, 0, D1);
     computeDisparity(p_support, tri_2, disparity_grid_2, grid_dims, desc1.I_desc, desc2.I_desc, 1, D2);
 
+    if (param.postprocess_fused) {
 #ifdef PROFILE
-    timer.start("L/R Consistency Check");
+        timer.start("Fused Post Processing");
 #endif
-    leftRightConsistencyCheck(D1, D2);
-
+        postProcessFused(D1, D2);
+    } else {
 #ifdef PROFILE
-    timer.start("Remove Small Segments");
+        timer.start("L/R Consistency Check");
 #endif
-    removeSmallSegments(D1);
-    if (!param.postprocess_only_left)
-        removeSmallSegments(D2);
+        leftRightConsistencyCheck(D1, D2);
 
 #ifdef PROFILE
-    timer.start("Gap Interpolation");
+        timer.start("Remove Small Segments");
 #endif
-    gapInterpolation(D1);
-    if (!param.postprocess_only_left)
-        gapInterpolation(D2);
+        removeSmallSegments(D1);
+        if (!param.postprocess_only_left)
+            removeSmallSegments(D2);
 
-    if (param.filter_adaptive_mean) {
 #ifdef PROFILE
-        timer.start("Adaptive Mean");
+        timer.start("Gap Interpolation");
 #endif
-        adaptiveMean(D1);
+        gapInterpolation(D1);
         if (!param.postprocess_only_left)
-            adaptiveMean(D2);
-    }
+            gapInterpolation(D2);
 
-    if (param.filter_median) {
+        if (param.filter_adaptive_mean) {
 #ifdef PROFILE
-        timer.start("Median");
+            timer.start("Adaptive Mean");
 #endif
-        median(D1);
-        if (!param.postprocess_only_left)
-            median(D2);
+            adaptiveMean(D1);
+            if (!param.postprocess_only_left)
+                adaptiveMean(D2);
+        }
+
+        if (param.filter_median) {
+#ifdef PROFILE
+            timer.start("Median");
+#endif
+            median(D1);
+            if (!param.postprocess_only_left)
+                median(D2);
+        }
     }
 
 #ifdef PROFILE
     timer.plot();
+    printf("Heap allocations so far: %lu\n", (unsigned long)getAllocationCount());
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Peak RSS: %.1f MB\n", usage.ru_maxrss / 1024.0);  // ru_maxrss is in KB
+    printf("Matching kernels: %s\n", matching::isaName(matching::currentIsa()));
     printf("\n");
 #endif
+}
+
+void Elas::postProcessFused(float *D1, float *D2) {
+    // get disparity image dimensions
+    int32_t D_width = width;
+    int32_t D_height = height;
+    if (param.subsampling) {
+        D_width = width / 2;
+        D_height = height / 2;
+    }
 
-    // release memory
-    free(disparity_grid_1);
-    free(disparity_grid_2);
-    _mm_free(I1);
-    _mm_free(I2);
+    // the L/R consistency check and the post processing run on bands of postprocess_band rows,
+    // which stay in the cache from one step to the next; only the segments and the column-wise
+    // gaps need all bands done before going on
+    float *D[2] = {D1, D2};
+    int32_t num_images = param.postprocess_only_left ? 1 : 2;
+    int32_t num_bands = (D_height + postprocess_band - 1) / postprocess_band;
+
+    // 1. L/R consistency check, segments of the left bands
+    for (int32_t b = 0; b < num_bands; b++) {
+        int32_t v_min = b * postprocess_band;
+        int32_t v_max = min(v_min + postprocess_band, D_height);
+        for (int32_t v = v_min; v < v_max; v++)
+            leftRightConsistencyCheckRow(D1, D2, ws.D_band, ws.D_band + D_width, v);
+        labelSegments(D1, ws.seg_parent, ws.seg_size, v_min, v_max);
+    }
+
+    for (int32_t i = 0; i < num_images; i++) {
+        // 2. segments of the whole image (the right image has the union-find forest after the left one)
+        for (int32_t b = 0; i > 0 && b < num_bands; b++)
+            labelSegments(D[i], ws.seg_parent, ws.seg_size, b * postprocess_band, min((b + 1) * postprocess_band, D_height));
+        joinSegments(D[i], ws.seg_parent, ws.seg_size, postprocess_band);
+
+        // 3. removal of small segments and row-wise gap interpolation into the scratch image
+        for (int32_t b = 0; b < num_bands; b++) {
+            int32_t v_min = b * postprocess_band;
+            int32_t v_max = min(v_min + postprocess_band, D_height);
+            invalidateSmallSegments(D[i], ws.D_tmp2, ws.seg_parent, ws.seg_size, v_min, v_max);
+            for (int32_t v = v_min; v < v_max; v++)
+                gapInterpolationRow(ws.D_tmp2, v);
+        }
+
+        // 4. column-wise gap interpolation and filters
+        postProcessRows(ws.D_tmp2, D[i], ws.D_band, 0, D_height);
+    }
+}
+
+void Elas::allocateWorkspace() {
+    releaseWorkspace();
+    ws.width = width;
+    ws.height = height;
+
+    // disparity grid and its helpers
+    int32_t grid_width = (int32_t)ceil((float)width / (float)param.grid_size);
+    int32_t grid_height = (int32_t)ceil((float)height / (float)param.grid_size);
+    // candidate mask per grid cell, rounded up to 128 bits for the dilation in createGrid()
+    ws.grid_dims[0] = (param.disp_max + 128) / 128 * 2;
+    ws.grid_dims[1] = grid_width;
+    ws.grid_dims[2] = grid_height;
+    ws.disparity_grid_1 = allocateBuffer<uint64_t>(ws.grid_dims[0] * grid_height * grid_width);
+    ws.disparity_grid_2 = allocateBuffer<uint64_t>(ws.grid_dims[0] * grid_height * grid_width);
+    for (int32_t i = 0; i < 2; i++) {
+        ws.grid_temp[i] = allocateBuffer<uint64_t>(ws.grid_dims[0] * grid_height * grid_width);
+    }
+
+    // support point candidates
+    int32_t D_candidate_stepsize = param.candidate_stepsize;
+    if (param.subsampling)
+        D_candidate_stepsize += D_candidate_stepsize % 2;
+    ws.D_can_width = 0;
+    ws.D_can_height = 0;
+    for (int32_t u = 0; u < width; u += D_candidate_stepsize)
+        ws.D_can_width++;
+    for (int32_t v = 0; v < height; v += D_candidate_stepsize)
+        ws.D_can_height++;
+    ws.D_can = allocateBuffer<int16_t>(ws.D_can_width * ws.D_can_height);
+    if (param.temporal)
+        ws.D_can_prev = allocateBuffer<int16_t>(ws.D_can_width * ws.D_can_height);
+    ws.frames = 0;
+
+    // the support points, their triangulation input and the triangles can not
+    // outnumber the candidates (plus corners), so reserving them once is enough
+    int32_t max_support = ws.D_can_width * ws.D_can_height + 6;
+    ws.pointlist = allocateBuffer<int32_t>(max_support * 2 * 2);
+    ws.delaunay1.reserve(max_support);
+    ws.delaunay2.reserve(max_support);
+    reserveVector(ws.p_support, max_support);
+    reserveVector(ws.tri_1, 2 * max_support);
+    reserveVector(ws.tri_2, 2 * max_support);
+
+    // pre-compute prior
+    int32_t disp_num = param.disp_max + 1;
+    float two_sigma_squared = 2 * param.sigma * param.sigma;
+    ws.P = allocateBuffer<int32_t>(disp_num);
+    for (int32_t delta_d = 0; delta_d < disp_num; delta_d++)
+        ws.P[delta_d] = (int32_t)((-log(param.gamma + exp(-delta_d * delta_d / two_sigma_squared)) + log(param.gamma)) / param.beta);
+
+    // post processing scratch images
+    int32_t D_size = param.subsampling ? (width / 2) * (height / 2) : width * height;
+    ws.D_tmp1 = allocateBuffer<float>(D_size);
+    ws.D_tmp2 = allocateBuffer<float>(D_size);
+    ws.seg_parent = allocateBuffer<int32_t>(D_size);
+    ws.seg_size = allocateBuffer<int32_t>(D_size);
+    if (param.postprocess_fused) {
+        // three band sized scratch images for postProcessRows()
+        int32_t D_width = param.subsampling ? width / 2 : width;
+        ws.D_band = allocateBuffer<float>(3 * (postprocess_band + 2 * postprocess_halo) * D_width);
+    }
+
+    ws.valid = true;
+}
+
+void Elas::releaseWorkspace() {
+    _mm_free(ws.disparity_grid_1);
+    _mm_free(ws.disparity_grid_2);
+    for (int32_t i = 0; i < 2; i++) {
+        _mm_free(ws.grid_temp[i]);
+    }
+    _mm_free(ws.D_can);
+    _mm_free(ws.D_can_prev);
+    _mm_free(ws.P);
+    _mm_free(ws.pointlist);
+    _mm_free(ws.D_tmp1);
+    _mm_free(ws.D_tmp2);
+    _mm_free(ws.seg_parent);
+    _mm_free(ws.seg_size);
+    _mm_free(ws.D_band);
+    ws.disparity_grid_1 = ws.disparity_grid_2 = 0;
+    ws.grid_temp[0] = ws.grid_temp[1] = 0;
+    ws.D_can = 0;
+    ws.D_can_prev = 0;
+    ws.P = 0;
+    ws.pointlist = 0;
+    ws.D_tmp1 = ws.D_tmp2 = 0;
+    ws.seg_parent = ws.seg_size = 0;
+    ws.D_band = 0;
+    ws.valid = false;
 }
 
 void Elas::removeInconsistentSupportPoints(int16_t *D_can, int32_t D_can_width, int32_t D_can_height) {
@@ -234,14 +441,11 @@ void Elas::removeRedundantSupportPoints(int16_t *D_can,
 
 void Elas::addCornerSupportPoints(vector<support_pt> &p_support) {
     // list of border points
-    vector<support_pt> p_border;
-    p_border.push_back(support_pt(0, 0, 0));
-    p_border.push_back(support_pt(0, height - 1, 0));
-    p_border.push_back(support_pt(width - 1, 0, 0));
-    p_border.push_back(support_pt(width - 1, height - 1, 0));
+    support_pt p_border[6] = {support_pt(0, 0, 0), support_pt(0, height - 1, 0), support_pt(width - 1, 0, 0), support_pt(width - 1, height - 1, 0),
+                              support_pt(0, 0, 0), support_pt(0, 0, 0)};
 
     // find closest d
-    for (int32_t i = 0; i < p_border.size(); i++) {
+    for (int32_t i = 0; i < 4; i++) {
         int32_t best_dist = 10000000;
         for (int32_t j = 0; j < p_support.size(); j++) {
             int32_t du = p_border[i].u - p_support[j].u;
@@ -255,30 +459,32 @@ void Elas::addCornerSupportPoints(vector<support_pt> &p_support) {
     }
 
     // for right image
-    p_border.push_back(support_pt(p_border[2].u + p_border[2].d, p_border[2].v, p_border[2].d));
-    p_border.push_back(support_pt(p_border[3].u + p_border[3].d, p_border[3].v, p_border[3].d));
+    p_border[4] = support_pt(p_border[2].u + p_border[2].d, p_border[2].v, p_border[2].d);
+    p_border[5] = support_pt(p_border[3].u + p_border[3].d, p_border[3].v, p_border[3].d);
 
     // add border points to support points
-    for (int32_t i = 0; i < p_border.size(); i++)
+    for (int32_t i = 0; i < 6; i++)
         p_support.push_back(p_border[i]);
 }
 
-inline int16_t Elas::computeMatchingDisparity(const int32_t &u, const int32_t &v, uint8_t *I1_desc, uint8_t *I2_desc, const bool &right_image) {
+inline int16_t Elas::computeMatchingDisparity(const int32_t &u, const int32_t &v, uint8_t *I1_desc, uint8_t *I2_desc, const bool &right_image,
+                                             const int32_t &disp_min_window, const int32_t &disp_max_window) {
     const int32_t u_step = 2;
     const int32_t v_step = 2;
     const int32_t window_size = 3;
 
-    int32_t desc_offset_1 = -16 * u_step - 16 * width * v_step;
-    int32_t desc_offset_2 = +16 * u_step - 16 * width * v_step;
-    int32_t desc_offset_3 = -16 * u_step + 16 * width * v_step;
-    int32_t desc_offset_4 = +16 * u_step + 16 * width * v_step;
+    // half resolution descriptors only hold the (even) rows the matching reads
+    const int32_t desc_step = param.subsampling ? 2 : 1;
 
-    __m128i xmm1, xmm2, xmm3, xmm4, xmm5, xmm6;
+    int32_t desc_offset_1 = -16 * u_step - 16 * width * (v_step / desc_step);
+    int32_t desc_offset_2 = +16 * u_step - 16 * width * (v_step / desc_step);
+    int32_t desc_offset_3 = -16 * u_step + 16 * width * (v_step / desc_step);
+    int32_t desc_offset_4 = +16 * u_step + 16 * width * (v_step / desc_step);
 
     // check if we are inside the image region
     if (u >= window_size + u_step && u <= width - window_size - 1 - u_step && v >= window_size + v_step && v <= height - window_size - 1 - v_step) {
         // compute desc and start addresses
-        int32_t line_offset = 16 * width * v;
+        int32_t line_offset = 16 * width * (v / desc_step);
         uint8_t *I1_line_addr, *I2_line_addr;
         if (!right_image) {
             I1_line_addr = I1_desc + line_offset;
@@ -290,7 +496,6 @@ inline int16_t Elas::computeMatchingDisparity(const int32_t &u, const int32_t &v
 
         // compute I1 block start addresses
         uint8_t *I1_block_addr = I1_line_addr + 16 * u;
-        uint8_t *I2_block_addr;
 
         // we require at least some texture
         int32_t sum = 0;
@@ -299,15 +504,6 @@ inline int16_t Elas::computeMatchingDisparity(const int32_t &u, const int32_t &v
         if (sum < param.support_texture)
             return -1;
 
-        // load first blocks to xmm registers
-        xmm1 = _mm_load_si128((__m128i *)(I1_block_addr + desc_offset_1));
-        xmm2 = _mm_load_si128((__m128i *)(I1_block_addr + desc_offset_2));
-        xmm3 = _mm_load_si128((__m128i *)(I1_block_addr + desc_offset_3));
-        xmm4 = _mm_load_si128((__m128i *)(I1_block_addr + desc_offset_4));
-
-        // declare match energy for each disparity
-        int32_t u_warp;
-
         // best match
         int16_t min_1_E = 32767;
         int16_t min_1_d = -1;
@@ -326,40 +522,34 @@ inline int16_t Elas::computeMatchingDisparity(const int32_t &u, const int32_t &v
         if (disp_max_valid - disp_min_valid < 10)
             return -1;
 
-        // for all disparities do
-        for (int16_t d = disp_min_valid; d <= disp_max_valid; d++) {
-            // warp u coordinate
-            if (!right_image)
-                u_warp = u - d;
-            else
-                u_warp = u + d;
-
-            // compute I2 block start addresses
-            I2_block_addr = I2_line_addr + 16 * u_warp;
-
-            // compute match energy at this disparity
-            xmm6 = _mm_load_si128((__m128i *)(I2_block_addr + desc_offset_1));
-            xmm6 = _mm_sad_epu8(xmm1, xmm6);
-            xmm5 = _mm_load_si128((__m128i *)(I2_block_addr + desc_offset_2));
-            xmm6 = _mm_add_epi16(_mm_sad_epu8(xmm2, xmm5), xmm6);
-            xmm5 = _mm_load_si128((__m128i *)(I2_block_addr + desc_offset_3));
-            xmm6 = _mm_add_epi16(_mm_sad_epu8(xmm3, xmm5), xmm6);
-            xmm5 = _mm_load_si128((__m128i *)(I2_block_addr + desc_offset_4));
-            xmm6 = _mm_add_epi16(_mm_sad_epu8(xmm4, xmm5), xmm6);
-            sum = _mm_extract_epi16(xmm6, 0) + _mm_extract_epi16(xmm6, 4);
-
-            // best + second best match
-            if (sum < min_1_E) {
-                min_2_E = min_1_E;
-                min_2_d = min_1_d;
-                min_1_E = sum;
-                min_1_d = d;
-            } else if (sum < min_2_E) {
-                min_2_E = sum;
-                min_2_d = d;
-            }
+        // bounded range of this row (setRowDisparityRange())
+        if (row_min) {
+            disp_min_valid = max(disp_min_valid, row_min[v]);
+            disp_max_valid = min(disp_max_valid, row_max[v]);
+            if (disp_max_valid - disp_min_valid < 2)
+                return -1;
+        }
+
+        // video mode: only search the given window of the disparity range
+        int32_t disp_min_search = disp_min_valid;
+        int32_t disp_max_search = disp_max_valid;
+        if (disp_max_window >= 0) {
+            disp_min_search = max(disp_min_valid, disp_min_window);
+            disp_max_search = min(disp_max_valid, disp_max_window);
+            if (disp_max_search - disp_min_search < 2)
+                return -1;
         }
 
+        // for all disparities do
+        const int32_t desc_offset[4] = {desc_offset_1, desc_offset_2, desc_offset_3, desc_offset_4};
+        matching::supportMinimum(I1_block_addr, I2_line_addr, desc_offset, u, right_image, disp_min_search, disp_max_search, min_1_E, min_1_d, min_2_E,
+                                 min_2_d);
+
+        // a minimum on the border of the window may just be the slope towards a better match outside of it
+        if (disp_max_window >= 0 && ((min_1_d == disp_min_search && disp_min_search > disp_min_valid) ||
+                                     (min_1_d == disp_max_search && disp_max_search < disp_max_valid)))
+            return -1;
+
         // check if best and second best match are available and if matching ratio is sufficient
         if (min_1_d >= 0 && min_2_d >= 0 && (float)min_1_E < param.support_threshold * (float)min_2_E)
             return min_1_d;
@@ -370,21 +560,26 @@ inline int16_t Elas::computeMatchingDisparity(const int32_t &u, const int32_t &v
         return -1;
 }
 
-vector<Elas::support_pt> Elas::computeSupportMatches(uint8_t *I1_desc, uint8_t *I2_desc) {
+void Elas::computeSupportMatches(uint8_t *I1_desc, uint8_t *I2_desc, vector<support_pt> &p_support) {
     // be sure that at half resolution we only need data
     // from every second line!
     int32_t D_candidate_stepsize = param.candidate_stepsize;
     if (param.subsampling)
         D_candidate_stepsize += D_candidate_stepsize % 2;
 
-    // create matrix for saving disparity candidates
-    int32_t D_can_width = 0;
-    int32_t D_can_height = 0;
-    for (int32_t u = 0; u < width; u += D_candidate_stepsize)
-        D_can_width++;
-    for (int32_t v = 0; v < height; v += D_candidate_stepsize)
-        D_can_height++;
-    int16_t *D_can = (int16_t *)calloc(D_can_width * D_can_height, sizeof(int16_t));
+    // matrix for saving disparity candidates
+    int32_t D_can_width = ws.D_can_width;
+    int32_t D_can_height = ws.D_can_height;
+    int16_t *D_can = ws.D_can;
+    memset(D_can, 0, D_can_width * D_can_height * sizeof(int16_t));
+
+    // video mode: every candidate matched in the previous frame is re-verified in a small window
+    // around its old disparity, only the ones failing this get a full search (as well as the
+    // candidate rows which are due for a refresh in this frame)
+    bool warm_start = param.temporal && ws.frames > 0;
+    int32_t refresh = param.temporal_refresh;
+    int16_t *D_can_prev = ws.D_can_prev;
+    int32_t r = param.temporal_radius;
 
     // loop variables
     int32_t u, v;
@@ -399,6 +594,19 @@ vector<Elas::support_pt> Elas::computeSupportMatches(uint8_t *I1_desc, uint8_t *
             // initialize disparity candidate to invalid
             *(D_can + getAddressOffsetImage(u_can, v_can, D_can_width)) = -1;
 
+            // re-verify the candidate of the previous frame
+            d = warm_start ? *(D_can_prev + getAddressOffsetImage(u_can, v_can, D_can_width)) : -1;
+            if (d >= 0 && (refresh <= 0 || v_can % refresh != ws.frames % refresh)) {
+                d = computeMatchingDisparity(u, v, I1_desc, I2_desc, false, d - r, d + r);
+                if (d >= 0) {
+                    d2 = computeMatchingDisparity(u - d, v, I1_desc, I2_desc, true, d - r, d + r);
+                    if (d2 >= 0 && abs(d - d2) <= param.lr_threshold) {
+                        *(D_can + getAddressOffsetImage(u_can, v_can, D_can_width)) = d;
+                        continue;
+                    }
+                }
+            }
+
             // find forwards
             d = computeMatchingDisparity(u, v, I1_desc, I2_desc, false);
             if (d >= 0) {
@@ -410,6 +618,11 @@ vector<Elas::support_pt> Elas::computeSupportMatches(uint8_t *I1_desc, uint8_t *
         }
     }
 
+    // video mode: keep the consistent candidates for the next frame
+    if (param.temporal)
+        memcpy(D_can_prev, D_can, D_can_width * D_can_height * sizeof(int16_t));
+    ws.frames++;
+
     // remove inconsistent support points
     removeInconsistentSupportPoints(D_can, D_can_width, D_can_height);
 
@@ -420,7 +633,7 @@ vector<Elas::support_pt> Elas::computeSupportMatches(uint8_t *I1_desc, uint8_t *
     removeRedundantSupportPoints(D_can, D_can_width, D_can_height, 5, 1, false);
 
     // move support points from image representation into a vector representation
-    vector<support_pt> p_support;
+    p_support.clear();
     for (int32_t u_can = 1; u_can < D_can_width; u_can++)
         for (int32_t v_can = 1; v_can < D_can_height; v_can++)
             if (*(D_can + getAddressOffsetImage(u_can, v_can, D_can_width)) >= 0)
@@ -431,157 +644,96 @@ vector<Elas::support_pt> Elas::computeSupportMatches(uint8_t *I1_desc, uint8_t *
     // with the same disparity as the nearest neighbor support point
     if (param.add_corners)
         addCornerSupportPoints(p_support);
-
-    // free memory
-    free(D_can);
-
-    // return support point vector
-    return p_support;
 }
 
-vector<Elas::triangle> Elas::computeDelaunayTriangulation(vector<support_pt> p_support, int32_t right_image) {
-    // input/output structure for triangulation
-    struct triangulateio in, out;
-    int32_t k;
-
-    // inputs
-    in.numberofpoints = p_support.size();
-    in.pointlist = (float *)malloc(in.numberofpoints * 2 * sizeof(float));
-    k = 0;
-    if (!right_image) {
-        for (int32_t i = 0; i < p_support.size(); i++) {
-            in.pointlist[k++] = p_support[i].u;
-            in.pointlist[k++] = p_support[i].v;
-        }
-    } else {
-        for (int32_t i = 0; i < p_support.size(); i++) {
-            in.pointlist[k++] = p_support[i].u - p_support[i].d;
-            in.pointlist[k++] = p_support[i].v;
-        }
+void Elas::computeDelaunayTriangulation(const vector<support_pt> &p_support, int32_t right_image, vector<triangle> &tri) {
+    // inputs (each image gets its own half of the point list buffer)
+    int32_t n = p_support.size();
+    int32_t *u = ws.pointlist + (right_image ? n * 2 : 0);
+    int32_t *v = u + n;
+    for (int32_t i = 0; i < n; i++) {
+        u[i] = right_image ? p_support[i].u - p_support[i].d : p_support[i].u;
+        v[i] = p_support[i].v;
     }
-    in.numberofpointattributes = 0;
-    in.pointattributelist = NULL;
-    in.pointmarkerlist = NULL;
-    in.numberofsegments = 0;
-    in.numberofholes = 0;
-    in.numberofregions = 0;
-    in.regionlist = NULL;
-
-    // outputs
-    out.pointlist = NULL;
-    out.pointattributelist = NULL;
-    out.pointmarkerlist = NULL;
-    out.trianglelist = NULL;
-    out.triangleattributelist = NULL;
-    out.neighborlist = NULL;
-    out.segmentlist = NULL;
-    out.segmentmarkerlist = NULL;
-    out.edgelist = NULL;
-    out.edgemarkerlist = NULL;
-
-    // do triangulation (z=zero-based, n=neighbors, Q=quiet, B=no boundary markers)
-    char parameters[] = "zQB";
-    triangulate(parameters, &in, &out, NULL);
 
-    // put resulting triangles into vector tri
-    vector<triangle> tri;
-    k = 0;
-    for (int32_t i = 0; i < out.numberoftriangles; i++) {
-        tri.push_back(triangle(out.trianglelist[k], out.trianglelist[k + 1], out.trianglelist[k + 2]));
-        k += 3;
-    }
+    // do triangulation
+    Delaunay &delaunay = right_image ? ws.delaunay2 : ws.delaunay1;
+    delaunay.triangulate(u, v, n);
 
-    // free memory used for triangulation
-    free(in.pointlist);
-    free(out.pointlist);
-    free(out.trianglelist);
+    // put resulting triangles into vector tri
+    tri.clear();
+    for (size_t k = 0; k < delaunay.triangles.size(); k += 3)
+        tri.push_back(triangle(delaunay.triangles[k], delaunay.triangles[k + 1], delaunay.triangles[k + 2]));
+}
 
-    // return triangles
-    return tri;
+void Elas::computeDisparityPlanes(const vector<support_pt> &p_support, vector<triangle> &tri, int32_t right_image) {
+    // the triangles are solved in blocks (see computeDisparityPlanesBlock())
+    int32_t num_tri = tri.size();
+    for (int32_t i = 0; i < num_tri; i += plane_block)
+        computeDisparityPlanesBlock(p_support, &tri[i], min(plane_block, num_tri - i));
 }
 
-void Elas::computeDisparityPlanes(vector<support_pt> p_support, vector<triangle> &tri, int32_t right_image) {
-    // init matrices
-    Matrix A(3, 3);
-    Matrix b(3, 1);
+void Elas::computeDisparityPlanesBlock(const vector<support_pt> &p_support, triangle *tri, int32_t n) {
+    // the plane d = a*u + b*v + c through the corners 1, 2, 3 of a triangle is solved in closed form
+    // (Cramer's rule on the edges 1->2 and 1->3): the determinant and the numerators are integers,
+    // which are exact in double precision, only the final division rounds. The corners of the
+    // block are gathered into SoA arrays first, such that the arithmetic is vectorized
+    double u1[plane_block], v1[plane_block], d1[plane_block];
+    double du2[plane_block], dv2[plane_block], dd2[plane_block];
+    double du3[plane_block], dv3[plane_block], dd3[plane_block];
+    for (int32_t i = 0; i < plane_block; i++) {
+        const support_pt &p1 = p_support[tri[i < n ? i : 0].c1];
+        const support_pt &p2 = p_support[tri[i < n ? i : 0].c2];
+        const support_pt &p3 = p_support[tri[i < n ? i : 0].c3];
+        u1[i] = p1.u;
+        v1[i] = p1.v;
+        d1[i] = p1.d;
+        du2[i] = p2.u - p1.u;
+        dv2[i] = p2.v - p1.v;
+        dd2[i] = p2.d - p1.d;
+        du3[i] = p3.u - p1.u;
+        dv3[i] = p3.v - p1.v;
+        dd3[i] = p3.d - p1.d;
+    }
 
-    // for all triangles do
-    for (int32_t i = 0; i < tri.size(); i++) {
-        // get triangle corner indices
-        int32_t c1 = tri[i].c1;
-        int32_t c2 = tri[i].c2;
-        int32_t c3 = tri[i].c3;
-
-        // compute matrix A for linear system of left triangle
-        A.val[0][0] = p_support[c1].u;
-        A.val[1][0] = p_support[c2].u;
-        A.val[2][0] = p_support[c3].u;
-        A.val[0][1] = p_support[c1].v;
-        A.val[0][2] = 1;
-        A.val[1][1] = p_support[c2].v;
-        A.val[1][2] = 1;
-        A.val[2][1] = p_support[c3].v;
-        A.val[2][2] = 1;
-
-        // compute vector b for linear system (containing the disparities)
-        b.val[0][0] = p_support[c1].d;
-        b.val[1][0] = p_support[c2].d;
-        b.val[2][0] = p_support[c3].d;
-
-        // on success of gauss jordan elimination
-        if (b.solve(A)) {
-            // grab results from b
-            tri[i].t1a = b.val[0][0];
-            tri[i].t1b = b.val[1][0];
-            tri[i].t1c = b.val[2][0];
-
-            // otherwise: invalid
-        } else {
-            tri[i].t1a = 0;
-            tri[i].t1b = 0;
-            tri[i].t1c = 0;
+    // left image (u) and right image (u - d), degenerate triangles get a zero plane
+    float t[6][plane_block];
+    for (int32_t right = 0; right < 2; right++) {
+        float *ta = t[right * 3], *tb = t[right * 3 + 1], *tc = t[right * 3 + 2];
+        for (int32_t i = 0; i < plane_block; i++) {
+            double u = u1[i] - right * d1[i];
+            double du_2 = du2[i] - right * dd2[i];
+            double du_3 = du3[i] - right * dd3[i];
+            double det = du_2 * dv3[i] - du_3 * dv2[i];
+            double num_a = dd2[i] * dv3[i] - dd3[i] * dv2[i];
+            double num_b = du_2 * dd3[i] - du_3 * dd2[i];
+            double num_c = d1[i] * det - num_a * u - num_b * v1[i];
+            ta[i] = det != 0 ? num_a / det : 0;
+            tb[i] = det != 0 ? num_b / det : 0;
+            tc[i] = det != 0 ? num_c / det : 0;
         }
+    }
 
-        // compute matrix A for linear system of right triangle
-        A.val[0][0] = p_support[c1].u - p_support[c1].d;
-        A.val[1][0] = p_support[c2].u - p_support[c2].d;
-        A.val[2][0] = p_support[c3].u - p_support[c3].d;
-        A.val[0][1] = p_support[c1].v;
-        A.val[0][2] = 1;
-        A.val[1][1] = p_support[c2].v;
-        A.val[1][2] = 1;
-        A.val[2][1] = p_support[c3].v;
-        A.val[2][2] = 1;
-
-        // compute vector b for linear system (containing the disparities)
-        b.val[0][0] = p_support[c1].d;
-        b.val[1][0] = p_support[c2].d;
-        b.val[2][0] = p_support[c3].d;
-
-        // on success of gauss jordan elimination
-        if (b.solve(A)) {
-            // grab results from b
-            tri[i].t2a = b.val[0][0];
-            tri[i].t2b = b.val[1][0];
-            tri[i].t2c = b.val[2][0];
-
-            // otherwise: invalid
-        } else {
-            tri[i].t2a = 0;
-            tri[i].t2b = 0;
-            tri[i].t2c = 0;
-        }
+    for (int32_t i = 0; i < n; i++) {
+        tri[i].t1a = t[0][i];
+        tri[i].t1b = t[1][i];
+        tri[i].t1c = t[2][i];
+        tri[i].t2a = t[3][i];
+        tri[i].t2b = t[4][i];
+        tri[i].t2c = t[5][i];
     }
 }
 
-void Elas::createGrid(vector<support_pt> p_support, int32_t *disparity_grid, int32_t *grid_dims, bool right_image) {
+void Elas::createGrid(const vector<support_pt> &p_support, uint64_t *disparity_grid, int32_t *grid_dims, bool right_image) {
     // get grid dimensions
+    int32_t grid_words = grid_dims[0];
     int32_t grid_width = grid_dims[1];
     int32_t grid_height = grid_dims[2];
 
-    // allocate temporary memory
-    int32_t *temp1 = (int32_t *)calloc((param.disp_max + 1) * grid_height * grid_width, sizeof(int32_t));
-    int32_t *temp2 = (int32_t *)calloc((param.disp_max + 1) * grid_height * grid_width, sizeof(int32_t));
+    // temporary memory
+    uint64_t *temp = ws.grid_temp[right_image];
+    memset(temp, 0, grid_words * grid_height * grid_width * sizeof(uint64_t));
+    memset(disparity_grid, 0, grid_words * grid_height * grid_width * sizeof(uint64_t));
 
     // for all support points do
     for (int32_t i = 0; i < p_support.size(); i++) {
@@ -593,95 +745,42 @@ void Elas::createGrid(vector<support_pt> p_support, int32_t *disparity_grid, int
         int32_t d_max = min(d_curr + 1, param.disp_max);
 
         // fill disparity grid helper
-        for (int32_t d = d_min; d <= d_max; d++) {
-            int32_t x;
-            if (!right_image)
-                x = floor((float)(x_curr / param.grid_size));
-            else
-                x = floor((float)(x_curr - d_curr) / (float)param.grid_size);
-            int32_t y = floor((float)y_curr / (float)param.grid_size);
-
-            // point may potentially lay outside (corner points)
-            if (x >= 0 && x < grid_width && y >= 0 && y < grid_height) {
-                int32_t addr = getAddressOffsetGrid(x, y, d, grid_width, param.disp_max + 1);
-                *(temp1 + addr) = 1;
-            }
-        }
-    }
-
-    // diffusion pointers
-    const int32_t *tl = temp1 + (0 * grid_width + 0) * (param.disp_max + 1);
-    const int32_t *tc = temp1 + (0 * grid_width + 1) * (param.disp_max + 1);
-    const int32_t *tr = temp1 + (0 * grid_width + 2) * (param.disp_max + 1);
-    const int32_t *cl = temp1 + (1 * grid_width + 0) * (param.disp_max + 1);
-    const int32_t *cc = temp1 + (1 * grid_width + 1) * (param.disp_max + 1);
-    const int32_t *cr = temp1 + (1 * grid_width + 2) * (param.disp_max + 1);
-    const int32_t *bl = temp1 + (2 * grid_width + 0) * (param.disp_max + 1);
-    const int32_t *bc = temp1 + (2 * grid_width + 1) * (param.disp_max + 1);
-    const int32_t *br = temp1 + (2 * grid_width + 2) * (param.disp_max + 1);
-
-    int32_t *result = temp2 + (1 * grid_width + 1) * (param.disp_max + 1);
-    int32_t *end_input = temp1 + grid_width * grid_height * (param.disp_max + 1);
-
-    // diffuse temporary grid
-    for (; br != end_input; tl++, tc++, tr++, cl++, cc++, cr++, bl++, bc++, br++, result++)
-        *result = *tl | *tc | *tr | *cl | *cc | *cr | *bl | *bc | *br;
-
-    // for all grid positions create disparity grid
-    for (int32_t x = 0; x < grid_width; x++) {
-        for (int32_t y = 0; y < grid_height; y++) {
-            // start with second value (first is reserved for count)
-            int32_t curr_ind = 1;
-
-            // for all disparities do
-            for (int32_t d = 0; d <= param.disp_max; d++) {
-                // if yes => add this disparity to current cell
-                if (*(temp2 + getAddressOffsetGrid(x, y, d, grid_width, param.disp_max + 1)) > 0) {
-                    *(disparity_grid + getAddressOffsetGrid(x, y, curr_ind, grid_width, param.disp_max + 2)) = d;
-                    curr_ind++;
-                }
-            }
-
-            // finally set number of indices
-            *(disparity_grid + getAddressOffsetGrid(x, y, 0, grid_width, param.disp_max + 2)) = curr_ind - 1;
+        int32_t x;
+        if (!right_image)
+            x = floor((float)(x_curr / param.grid_size));
+        else
+            x = floor((float)(x_curr - d_curr) / (float)param.grid_size);
+        int32_t y = floor((float)y_curr / (float)param.grid_size);
+
+        // point may potentially lay outside (corner points)
+        if (x >= 0 && x < grid_width && y >= 0 && y < grid_height) {
+            uint64_t *cell = temp + getAddressOffsetGrid(x, y, 0, grid_width, grid_words);
+            for (int32_t d = d_min; d <= d_max; d++)
+                cell[d / 64] |= 1ULL << (d % 64);
         }
     }
 
-    // release temporary memory
-    free(temp1);
-    free(temp2);
-}
-
-inline void Elas::updatePosteriorMinimum(__m128i *I2_block_addr,
-                                         const int32_t &d,
-                                         const int32_t &w,
-                                         const __m128i &xmm1,
-                                         __m128i &xmm2,
-                                         int32_t &val,
-                                         int32_t &min_val,
-                                         int32_t &min_d) {
-    xmm2 = _mm_load_si128(I2_block_addr);
-    xmm2 = _mm_sad_epu8(xmm1, xmm2);
-    val = _mm_extract_epi16(xmm2, 0) + _mm_extract_epi16(xmm2, 4) + w;
-    if (val < min_val) {
-        min_val = val;
-        min_d = d;
-    }
-}
-
-inline void Elas::updatePosteriorMinimum(__m128i *I2_block_addr,
-                                         const int32_t &d,
-                                         const __m128i &xmm1,
-                                         __m128i &xmm2,
-                                         int32_t &val,
-                                         int32_t &min_val,
-                                         int32_t &min_d) {
-    xmm2 = _mm_load_si128(I2_block_addr);
-    xmm2 = _mm_sad_epu8(xmm1, xmm2);
-    val = _mm_extract_epi16(xmm2, 0) + _mm_extract_epi16(xmm2, 4);
-    if (val < min_val) {
-        min_val = val;
-        min_d = d;
+    // diffusion pointers (128 bit lanes, every cell starts at a lane)
+    const int32_t lanes = grid_words / 2;
+    const __m128i *tl = (__m128i *)temp + (0 * grid_width + 0) * lanes;
+    const __m128i *tc = (__m128i *)temp + (0 * grid_width + 1) * lanes;
+    const __m128i *tr = (__m128i *)temp + (0 * grid_width + 2) * lanes;
+    const __m128i *cl = (__m128i *)temp + (1 * grid_width + 0) * lanes;
+    const __m128i *cc = (__m128i *)temp + (1 * grid_width + 1) * lanes;
+    const __m128i *cr = (__m128i *)temp + (1 * grid_width + 2) * lanes;
+    const __m128i *bl = (__m128i *)temp + (2 * grid_width + 0) * lanes;
+    const __m128i *bc = (__m128i *)temp + (2 * grid_width + 1) * lanes;
+    const __m128i *br = (__m128i *)temp + (2 * grid_width + 2) * lanes;
+
+    __m128i *result = (__m128i *)disparity_grid + (1 * grid_width + 1) * lanes;
+    const __m128i *end_input = (__m128i *)temp + grid_width * grid_height * lanes;
+
+    // diffuse temporary grid: the candidates of a cell are the union of its 3x3 neighborhood
+    for (; br < end_input; tl++, tc++, tr++, cl++, cc++, cr++, bl++, bc++, br++, result++) {
+        __m128i t = _mm_or_si128(_mm_or_si128(_mm_load_si128(tl), _mm_load_si128(tc)), _mm_load_si128(tr));
+        __m128i c = _mm_or_si128(_mm_or_si128(_mm_load_si128(cl), _mm_load_si128(cc)), _mm_load_si128(cr));
+        __m128i b = _mm_or_si128(_mm_or_si128(_mm_load_si128(bl), _mm_load_si128(bc)), _mm_load_si128(br));
+        _mm_store_si128(result, _mm_or_si128(_mm_or_si128(t, c), b));
     }
 }
 
@@ -690,7 +789,7 @@ inline void Elas::findMatch(int32_t &u,
                             float &plane_a,
                             float &plane_b,
                             float &plane_c,
-                            int32_t *disparity_grid,
+                            uint64_t *disparity_grid,
                             int32_t *grid_dims,
                             uint8_t *I1_desc,
                             uint8_t *I2_desc,
@@ -700,7 +799,7 @@ inline void Elas::findMatch(int32_t &u,
                             bool &right_image,
                             float *D) {
     // get image width and height
-    const int32_t disp_num = grid_dims[0] - 1;
+    const int32_t disp_num = param.disp_max + 1;
     const int32_t window_size = 2;
 
     // address of disparity we want to compute
@@ -715,7 +814,10 @@ inline void Elas::findMatch(int32_t &u,
         return;
 
     // compute line start address
-    int32_t line_offset = 16 * width * max(min(v, height - 3), 2);
+    // (half resolution descriptors only hold the even rows, the odd row height - 3 is never
+    // computed and neither is the row below it)
+    int32_t desc_step = param.subsampling ? 2 : 1;
+    int32_t line_offset = 16 * width * ((max(min(v, height - 3), 2) + desc_step - 1) / desc_step);
     uint8_t *I1_line_addr, *I2_line_addr;
     if (!right_image) {
         I1_line_addr = I1_desc + line_offset;
@@ -744,54 +846,22 @@ inline void Elas::findMatch(int32_t &u,
     int32_t grid_x = (int32_t)floor((float)u / (float)param.grid_size);
     int32_t grid_y = (int32_t)floor((float)v / (float)param.grid_size);
     uint32_t grid_addr = getAddressOffsetGrid(grid_x, grid_y, 0, grid_dims[1], grid_dims[0]);
-    int32_t num_grid = *(disparity_grid + grid_addr);
-    int32_t *d_grid = disparity_grid + grid_addr + 1;
+    const uint64_t *d_grid = disparity_grid + grid_addr;
+
+    // the warped column of the match lies between u_warp_min and u_warp_max, within the bounded range of
+    // this row (setRowDisparityRange())
+    int32_t u_warp_min = window_size;
+    int32_t u_warp_max = width - window_size - 1;
+    if (row_min) {
+        u_warp_min = max(u_warp_min, right_image ? u + row_min[v] : u - row_max[v]);
+        u_warp_max = min(u_warp_max, right_image ? u + row_max[v] : u - row_min[v]);
+    }
 
-    // loop variables
-    int32_t d_curr, u_warp, val;
+    // find the minimum of the posterior energy
     int32_t min_val = 10000;
     int32_t min_d = -1;
-    __m128i xmm1 = _mm_load_si128((__m128i *)I1_block_addr);
-    __m128i xmm2;
-
-    // left image
-    if (!right_image) {
-        for (int32_t i = 0; i < num_grid; i++) {
-            d_curr = d_grid[i];
-            if (d_curr < d_plane_min || d_curr > d_plane_max) {
-                u_warp = u - d_curr;
-                if (u_warp < window_size || u_warp >= width - window_size)
-                    continue;
-                updatePosteriorMinimum((__m128i *)(I2_line_addr + 16 * u_warp), d_curr, xmm1, xmm2, val, min_val, min_d);
-            }
-        }
-        for (d_curr = d_plane_min; d_curr <= d_plane_max; d_curr++) {
-            u_warp = u - d_curr;
-            if (u_warp < window_size || u_warp >= width - window_size)
-                continue;
-            updatePosteriorMinimum((__m128i *)(I2_line_addr + 16 * u_warp), d_curr, valid ? *(P + abs(d_curr - d_plane)) : 0, xmm1, xmm2, val,
-                                   min_val, min_d);
-        }
-
-        // right image
-    } else {
-        for (int32_t i = 0; i < num_grid; i++) {
-            d_curr = d_grid[i];
-            if (d_curr < d_plane_min || d_curr > d_plane_max) {
-                u_warp = u + d_curr;
-                if (u_warp < window_size || u_warp >= width - window_size)
-                    continue;
-                updatePosteriorMinimum((__m128i *)(I2_line_addr + 16 * u_warp), d_curr, xmm1, xmm2, val, min_val, min_d);
-            }
-        }
-        for (d_curr = d_plane_min; d_curr <= d_plane_max; d_curr++) {
-            u_warp = u + d_curr;
-            if (u_warp < window_size || u_warp >= width - window_size)
-                continue;
-            updatePosteriorMinimum((__m128i *)(I2_line_addr + 16 * u_warp), d_curr, valid ? *(P + abs(d_curr - d_plane)) : 0, xmm1, xmm2, val,
-                                   min_val, min_d);
-        }
-    }
+    matching::posteriorMinimum(I1_block_addr, I2_line_addr, u, right_image, u_warp_min, u_warp_max, d_grid, grid_dims[0], d_plane, d_plane_min,
+                               d_plane_max, valid ? P : 0, min_val, min_d);
 
     // set disparity value
     if (min_d >= 0)
@@ -801,20 +871,14 @@ inline void Elas::findMatch(int32_t &u,
 }
 
 // TODO: %2 => more elegantly
-void Elas::computeDisparity(vector<support_pt> p_support,
-                            vector<triangle> tri,
-                            int32_t *disparity_grid,
+void Elas::computeDisparity(const vector<support_pt> &p_support,
+                            const vector<triangle> &tri,
+                            uint64_t *disparity_grid,
                             int32_t *grid_dims,
                             uint8_t *I1_desc,
                             uint8_t *I2_desc,
                             bool right_image,
                             float *D) {
-    // number of disparities
-    const int32_t disp_num = grid_dims[0] - 1;
-
-    // descriptor window_size
-    int32_t window_size = 2;
-
     // init disparity image to -10
     if (param.subsampling) {
         for (int32_t i = 0; i < (width / 2) * (height / 2); i++)
@@ -824,11 +888,8 @@ void Elas::computeDisparity(vector<support_pt> p_support,
             *(D + i) = -10;
     }
 
-    // pre-compute prior
-    float two_sigma_squared = 2 * param.sigma * param.sigma;
-    int32_t *P = new int32_t[disp_num];
-    for (int32_t delta_d = 0; delta_d < disp_num; delta_d++)
-        P[delta_d] = (int32_t)((-log(param.gamma + exp(-delta_d * delta_d / two_sigma_squared)) + log(param.gamma)) / param.beta);
+    // prior (pre-computed with the workspace)
+    int32_t *P = ws.P;
     int32_t plane_radius = (int32_t)max((float)ceil(param.sigma * param.sradius), (float)2.0);
 
     // loop variables
@@ -838,7 +899,6 @@ void Elas::computeDisparity(vector<support_pt> p_support,
     // for all triangles do
     for (uint32_t i = 0; i < tri.size(); i++) {
         // get plane parameters
-        uint32_t p_i = i * 3;
         if (!right_image) {
             plane_a = tri[i].t1a;
             plane_b = tri[i].t1b;
@@ -939,8 +999,6 @@ void Elas::computeDisparity(vector<support_pt> p_support,
             }
         }
     }
-
-    delete[] P;
 }
 
 void Elas::leftRightConsistencyCheck(float *D1, float *D2) {
@@ -952,185 +1010,133 @@ void Elas::leftRightConsistencyCheck(float *D1, float *D2) {
         D_height = height / 2;
     }
 
-    // make a copy of both images
-    float *D1_copy = (float *)malloc(D_width * D_height * sizeof(float));
-    float *D2_copy = (float *)malloc(D_width * D_height * sizeof(float));
-    memcpy(D1_copy, D1, D_width * D_height * sizeof(float));
-    memcpy(D2_copy, D2, D_width * D_height * sizeof(float));
+    // the rows are independent, their unchecked copies go to the scratch images
+    for (int32_t v = 0; v < D_height; v++) {
+        uint32_t addr = getAddressOffsetImage(0, v, D_width);
+        leftRightConsistencyCheckRow(D1, D2, ws.D_tmp1 + addr, ws.D_tmp2 + addr, v);
+    }
+}
 
-    // loop variables
-    uint32_t addr, addr_warp;
-    float u_warp_1, u_warp_2, d1, d2;
+void Elas::leftRightConsistencyCheckRow(float *D1, float *D2, float *D1_copy, float *D2_copy, int32_t v) {
+    // get disparity image width
+    int32_t D_width = width;
+    if (param.subsampling)
+        D_width = width / 2;
 
-    // for all image points do
-    for (int32_t u = 0; u < D_width; u++) {
-        for (int32_t v = 0; v < D_height; v++) {
-            // compute address (u,v) and disparity value
-            addr = getAddressOffsetImage(u, v, D_width);
-            d1 = *(D1_copy + addr);
-            d2 = *(D2_copy + addr);
-            if (param.subsampling) {
-                u_warp_1 = (float)u - d1 / 2;
-                u_warp_2 = (float)u + d2 / 2;
-            } else {
-                u_warp_1 = (float)u - d1;
-                u_warp_2 = (float)u + d2;
-            }
+    // make a copy of both rows
+    uint32_t addr_row = getAddressOffsetImage(0, v, D_width);
+    memcpy(D1_copy, D1 + addr_row, D_width * sizeof(float));
+    memcpy(D2_copy, D2 + addr_row, D_width * sizeof(float));
 
-            // check if left disparity is valid
-            if (d1 >= 0 && u_warp_1 >= 0 && u_warp_1 < D_width) {
-                // compute warped image address
-                addr_warp = getAddressOffsetImage((int32_t)u_warp_1, v, D_width);
+    // check both rows against the copies, the disparities are warped to the left resp. right
+    float warp = param.subsampling ? 0.5f : 1.0f;
+    filter::consistencyCheck(D1_copy, D2_copy, D1 + addr_row, -warp, param.lr_threshold, D_width);
+    filter::consistencyCheck(D2_copy, D1_copy, D2 + addr_row, warp, param.lr_threshold, D_width);
+}
 
-                // if check failed
-                if (fabs(*(D2_copy + addr_warp) - d1) > param.lr_threshold)
-                    *(D1 + addr) = -10;
+void Elas::removeSmallSegments(float *D) {
+    // get disparity image dimensions
+    int32_t D_height = height;
+    if (param.subsampling)
+        D_height = height / 2;
 
-                // set invalid
-            } else
-                *(D1 + addr) = -10;
+    // union-find forest over the pixels (-1: invalid pixel), a segment is a connected set of
+    // valid pixels whose 4-neighbors differ by at most speckle_sim_threshold
+    labelSegments(D, ws.seg_parent, ws.seg_size, 0, D_height);
 
-            // check if right disparity is valid
-            if (d2 >= 0 && u_warp_2 >= 0 && u_warp_2 < D_width) {
-                // compute warped image address
-                addr_warp = getAddressOffsetImage((int32_t)u_warp_2, v, D_width);
+    // invalidate the pixels of small segments
+    invalidateSmallSegments(D, D, ws.seg_parent, ws.seg_size, 0, D_height);
+}
 
-                // if check failed
-                if (fabs(*(D1_copy + addr_warp) - d2) > param.lr_threshold)
-                    *(D2 + addr) = -10;
+void Elas::labelSegments(const float *D, int32_t *parent, int32_t *size, int32_t v_min, int32_t v_max) {
+    // get disparity image width
+    int32_t D_width = width;
+    if (param.subsampling)
+        D_width = width / 2;
 
-                // set invalid
-            } else
-                *(D2 + addr) = -10;
+    // every pixel joins its left and upper neighbor (within the band)
+    for (int32_t v = v_min; v < v_max; v++) {
+        for (int32_t u = 0; u < D_width; u++) {
+            int32_t addr = getAddressOffsetImage(u, v, D_width);
+            float d = *(D + addr);
+            if (d < 0) {
+                parent[addr] = -1;
+                continue;
+            }
+            parent[addr] = addr;
+            size[addr] = 1;
+            if (u > 0 && *(D + addr - 1) >= 0 && fabs(d - *(D + addr - 1)) <= param.speckle_sim_threshold)
+                mergeSegments(parent, size, addr - 1, addr);
+            if (v > v_min && *(D + addr - D_width) >= 0 && fabs(d - *(D + addr - D_width)) <= param.speckle_sim_threshold)
+                mergeSegments(parent, size, addr - D_width, addr);
         }
     }
-
-    // release memory
-    free(D1_copy);
-    free(D2_copy);
 }
 
-void Elas::removeSmallSegments(float *D) {
+void Elas::joinSegments(const float *D, int32_t *parent, int32_t *size, int32_t band) {
     // get disparity image dimensions
     int32_t D_width = width;
     int32_t D_height = height;
-    int32_t D_speckle_size = param.speckle_size;
     if (param.subsampling) {
         D_width = width / 2;
         D_height = height / 2;
-        D_speckle_size = sqrt((float)param.speckle_size) * 2;
     }
 
-    // allocate memory on heap for dynamic programming arrays
-    int32_t *D_done = (int32_t *)calloc(D_width * D_height, sizeof(int32_t));
-    int32_t *seg_list_u = (int32_t *)calloc(D_width * D_height, sizeof(int32_t));
-    int32_t *seg_list_v = (int32_t *)calloc(D_width * D_height, sizeof(int32_t));
-    int32_t seg_list_count;
-    int32_t seg_list_curr;
-    int32_t u_neighbor[4];
-    int32_t v_neighbor[4];
-    int32_t u_seg_curr;
-    int32_t v_seg_curr;
-
-    // declare loop variables
-    int32_t addr_start, addr_curr, addr_neighbor;
-
-    // for all pixels do
-    for (int32_t u = 0; u < D_width; u++) {
-        for (int32_t v = 0; v < D_height; v++) {
-            // get address of first pixel in this segment
-            addr_start = getAddressOffsetImage(u, v, D_width);
-
-            // if this pixel has not already been processed
-            if (*(D_done + addr_start) == 0) {
-                // init segment list (add first element
-                // and set it to be the next element to check)
-                *(seg_list_u + 0) = u;
-                *(seg_list_v + 0) = v;
-                seg_list_count = 1;
-                seg_list_curr = 0;
-
-                // add neighboring segments as long as there
-                // are none-processed pixels in the seg_list;
-                // none-processed means: seg_list_curr<seg_list_count
-                while (seg_list_curr < seg_list_count) {
-                    // get current position from seg_list
-                    u_seg_curr = *(seg_list_u + seg_list_curr);
-                    v_seg_curr = *(seg_list_v + seg_list_curr);
-
-                    // get address of current pixel in this segment
-                    addr_curr = getAddressOffsetImage(u_seg_curr, v_seg_curr, D_width);
-
-                    // fill list with neighbor positions
-                    u_neighbor[0] = u_seg_curr - 1;
-                    v_neighbor[0] = v_seg_curr;
-                    u_neighbor[1] = u_seg_curr + 1;
-                    v_neighbor[1] = v_seg_curr;
-                    u_neighbor[2] = u_seg_curr;
-                    v_neighbor[2] = v_seg_curr - 1;
-                    u_neighbor[3] = u_seg_curr;
-                    v_neighbor[3] = v_seg_curr + 1;
-
-                    // for all neighbors do
-                    for (int32_t i = 0; i < 4; i++) {
-                        // check if neighbor is inside image
-                        if (u_neighbor[i] >= 0 && v_neighbor[i] >= 0 && u_neighbor[i] < D_width && v_neighbor[i] < D_height) {
-                            // get neighbor pixel address
-                            addr_neighbor = getAddressOffsetImage(u_neighbor[i], v_neighbor[i], D_width);
-
-                            // check if neighbor has not been added yet and if it is valid
-                            if (*(D_done + addr_neighbor) == 0 && *(D + addr_neighbor) >= 0) {
-                                // is the neighbor similar to the current pixel
-                                // (=belonging to the current segment)
-                                if (fabs(*(D + addr_curr) - *(D + addr_neighbor)) <= param.speckle_sim_threshold) {
-                                    // add neighbor coordinates to segment list
-                                    *(seg_list_u + seg_list_count) = u_neighbor[i];
-                                    *(seg_list_v + seg_list_count) = v_neighbor[i];
-                                    seg_list_count++;
-
-                                    // set neighbor pixel in I_done to "done"
-                                    // (otherwise a pixel may be added 2 times to the list, as
-                                    //  neighbor of one pixel and as neighbor of another pixel)
-                                    *(D_done + addr_neighbor) = 1;
-                                }
-                            }
-                        }
-                    }
-
-                    // set current pixel in seg_list to "done"
-                    seg_list_curr++;
-
-                    // set current pixel in I_done to "done"
-                    *(D_done + addr_curr) = 1;
+    // every pixel in the first row of a band joins its upper neighbor
+    for (int32_t v = band; v < D_height; v += band) {
+        int32_t addr = getAddressOffsetImage(0, v, D_width);
+        for (int32_t u = 0; u < D_width; u++, addr++) {
+            float d = *(D + addr);
+            if (d >= 0 && *(D + addr - D_width) >= 0 && fabs(d - *(D + addr - D_width)) <= param.speckle_sim_threshold)
+                mergeSegments(parent, size, addr - D_width, addr);
+        }
+    }
+}
 
-                }  // end: while (seg_list_curr<seg_list_count)
+void Elas::invalidateSmallSegments(const float *D, float *D_out, int32_t *parent, const int32_t *size, int32_t v_min, int32_t v_max) {
+    // get disparity image width
+    int32_t D_width = width;
+    int32_t D_speckle_size = param.speckle_size;
+    if (param.subsampling) {
+        D_width = width / 2;
+        D_speckle_size = sqrt((float)param.speckle_size) * 2;
+    }
 
-                // if segment NOT large enough => invalidate pixels
-                if (seg_list_count < D_speckle_size) {
-                    // for all pixels in current segment invalidate pixels
-                    for (int32_t i = 0; i < seg_list_count; i++) {
-                        addr_curr = getAddressOffsetImage(*(seg_list_u + i), *(seg_list_v + i), D_width);
-                        *(D + addr_curr) = -10;
-                    }
-                }
-            }  // end: if (*(I_done+addr_start)==0)
+    // an invalid pixel is a segment of size 1; the roots precede their members, so one pass
+    // resolves every pixel to its root (if the rows above v_min are resolved already)
+    for (int32_t addr = v_min * D_width; addr < v_max * D_width; addr++) {
+        if (parent[addr] < 0) {
+            *(D_out + addr) = 1 < D_speckle_size ? -10 : *(D + addr);
+            continue;
         }
+        parent[addr] = parent[parent[addr]];
+        *(D_out + addr) = size[parent[addr]] < D_speckle_size ? -10 : *(D + addr);
     }
-
-    // free memory
-    free(D_done);
-    free(seg_list_u);
-    free(seg_list_v);
 }
 
 void Elas::gapInterpolation(float *D) {
     // get disparity image dimensions
     int32_t D_width = width;
     int32_t D_height = height;
-    int32_t D_ipol_gap_width = param.ipol_gap_width;
     if (param.subsampling) {
         D_width = width / 2;
         D_height = height / 2;
+    }
+
+    // 1. Row-wise:
+    for (int32_t v = 0; v < D_height; v++)
+        gapInterpolationRow(D, v);
+
+    // 2. Column-wise:
+    gapInterpolationColumns(D, D, 0, D_height, 0, D_width);
+}
+
+void Elas::gapInterpolationRow(float *D, int32_t v) {
+    // get disparity image width
+    int32_t D_width = width;
+    int32_t D_ipol_gap_width = param.ipol_gap_width;
+    if (param.subsampling) {
+        D_width = width / 2;
         D_ipol_gap_width = param.ipol_gap_width / 2 + 1;
     }
 
@@ -1138,156 +1144,199 @@ void Elas::gapInterpolation(float *D) {
     float discon_threshold = 3.0;
 
     // declare loop variables
-    int32_t count, addr, v_first, v_last, u_first, u_last;
+    int32_t count, addr, u_first, u_last;
     float d1, d2, d_ipol;
 
-    // 1. Row-wise:
-    // for each row do
-    for (int32_t v = 0; v < D_height; v++) {
-        // init counter
-        count = 0;
+    // init counter
+    count = 0;
+
+    // for each element of the row do
+    for (int32_t u = 0; u < D_width; u++) {
+        // get address of this location
+        addr = getAddressOffsetImage(u, v, D_width);
+
+        // if disparity valid
+        if (*(D + addr) >= 0) {
+            // check if speckle is small enough
+            if (count >= 1 && count <= D_ipol_gap_width) {
+                // first and last value for interpolation
+                u_first = u - count;
+                u_last = u - 1;
+
+                // if value in range
+                if (u_first > 0 && u_last < D_width - 1) {
+                    // compute mean disparity
+                    d1 = *(D + getAddressOffsetImage(u_first - 1, v, D_width));
+                    d2 = *(D + getAddressOffsetImage(u_last + 1, v, D_width));
+                    if (fabs(d1 - d2) < discon_threshold)
+                        d_ipol = (d1 + d2) / 2;
+                    else
+                        d_ipol = min(d1, d2);
+
+                    // set all values to d_ipol
+                    for (int32_t u_curr = u_first; u_curr <= u_last; u_curr++)
+                        *(D + getAddressOffsetImage(u_curr, v, D_width)) = d_ipol;
+                }
+            }
+
+            // reset counter
+            count = 0;
+
+            // otherwise increment counter
+        } else {
+            count++;
+        }
+    }
 
-        // for each element of the row do
+    // if full size disp map requested
+    if (param.add_corners) {
+        // extrapolate to the left
         for (int32_t u = 0; u < D_width; u++) {
             // get address of this location
             addr = getAddressOffsetImage(u, v, D_width);
 
             // if disparity valid
             if (*(D + addr) >= 0) {
-                // check if speckle is small enough
-                if (count >= 1 && count <= D_ipol_gap_width) {
-                    // first and last value for interpolation
-                    u_first = u - count;
-                    u_last = u - 1;
-
-                    // if value in range
-                    if (u_first > 0 && u_last < D_width - 1) {
-                        // compute mean disparity
-                        d1 = *(D + getAddressOffsetImage(u_first - 1, v, D_width));
-                        d2 = *(D + getAddressOffsetImage(u_last + 1, v, D_width));
-                        if (fabs(d1 - d2) < discon_threshold)
-                            d_ipol = (d1 + d2) / 2;
-                        else
-                            d_ipol = min(d1, d2);
-
-                        // set all values to d_ipol
-                        for (int32_t u_curr = u_first; u_curr <= u_last; u_curr++)
-                            *(D + getAddressOffsetImage(u_curr, v, D_width)) = d_ipol;
-                    }
-                }
+                for (int32_t u2 = max(u - D_ipol_gap_width, 0); u2 < u; u2++)
+                    *(D + getAddressOffsetImage(u2, v, D_width)) = *(D + addr);
+                break;
+            }
+        }
 
-                // reset counter
-                count = 0;
+        // extrapolate to the right
+        for (int32_t u = D_width - 1; u >= 0; u--) {
+            // get address of this location
+            addr = getAddressOffsetImage(u, v, D_width);
 
-                // otherwise increment counter
-            } else {
-                count++;
+            // if disparity valid
+            if (*(D + addr) >= 0) {
+                for (int32_t u2 = u; u2 <= min(u + D_ipol_gap_width, D_width - 1); u2++)
+                    *(D + getAddressOffsetImage(u2, v, D_width)) = *(D + addr);
+                break;
             }
         }
+    }
+}
 
-        // if full size disp map requested
-        if (param.add_corners) {
-            // extrapolate to the left
-            for (int32_t u = 0; u < D_width; u++) {
-                // get address of this location
-                addr = getAddressOffsetImage(u, v, D_width);
+void Elas::gapInterpolationColumns(const float *D, float *D_out, int32_t v_min, int32_t v_max, int32_t u_min, int32_t u_max) {
+    // get disparity image dimensions
+    int32_t D_width = width;
+    int32_t D_height = height;
+    int32_t D_ipol_gap_width = param.ipol_gap_width;
+    if (param.subsampling) {
+        D_width = width / 2;
+        D_height = height / 2;
+        D_ipol_gap_width = param.ipol_gap_width / 2 + 1;
+    }
 
-                // if disparity valid
-                if (*(D + addr) >= 0) {
-                    for (int32_t u2 = max(u - D_ipol_gap_width, 0); u2 < u; u2++)
-                        *(D + getAddressOffsetImage(u2, v, D_width)) = *(D + addr);
-                    break;
-                }
-            }
+    // discontinuity threshold
+    float discon_threshold = 3.0;
 
-            // extrapolate to the right
-            for (int32_t u = D_width - 1; u >= 0; u--) {
-                // get address of this location
-                addr = getAddressOffsetImage(u, v, D_width);
+    // declare loop variables
+    int32_t count[gap_column_block], v_valid[gap_column_block];
+    int32_t addr, v_first, v_last, v_end, open;
+    float d1, d2, d_ipol;
 
-                // if disparity valid
-                if (*(D + addr) >= 0) {
-                    for (int32_t u2 = u; u2 <= min(u + D_ipol_gap_width, D_width - 1); u2++)
-                        *(D + getAddressOffsetImage(u2, v, D_width)) = *(D + addr);
-                    break;
-                }
-            }
+    // the columns are walked through row by row in blocks of gap_column_block columns, so every
+    // row of a block is one cache friendly run
+    for (int32_t u_block = u_min; u_block < u_max; u_block += gap_column_block) {
+        int32_t n = min(gap_column_block, u_max - u_block);
+
+        // init counters with the gaps reaching into the rows from above (a gap longer than
+        // D_ipol_gap_width is not interpolated, so counting stops there)
+        for (int32_t i = 0; i < n; i++) {
+            count[i] = 0;
+            for (int32_t v = v_min - 1; v >= 0 && count[i] <= D_ipol_gap_width && *(D + getAddressOffsetImage(u_block + i, v, D_width)) < 0; v--)
+                count[i]++;
         }
-    }
 
-    // 2. Column-wise:
-    // for each column do
-    for (int32_t u = 0; u < D_width; u++) {
-        // init counter
-        count = 0;
+        // for each row do, until no gap reaches into the rows anymore (count < 0: column done)
+        open = n;
+        for (int32_t v = v_min; v < D_height && open > 0; v++) {
+            for (int32_t i = 0; i < n; i++) {
+                if (count[i] < 0)
+                    continue;
 
-        // for each element of the column do
-        for (int32_t v = 0; v < D_height; v++) {
-            // get address of this location
-            addr = getAddressOffsetImage(u, v, D_width);
+                // get address of this location
+                int32_t u = u_block + i;
+                addr = getAddressOffsetImage(u, v, D_width);
 
-            // if disparity valid
-            if (*(D + addr) >= 0) {
-                // check if gap is small enough
-                if (count >= 1 && count <= D_ipol_gap_width) {
-                    // first and last value for interpolation
-                    v_first = v - count;
-                    v_last = v - 1;
-
-                    // if value in range
-                    if (v_first > 0 && v_last < D_height - 1) {
-                        // compute mean disparity
-                        d1 = *(D + getAddressOffsetImage(u, v_first - 1, D_width));
-                        d2 = *(D + getAddressOffsetImage(u, v_last + 1, D_width));
-                        if (fabs(d1 - d2) < discon_threshold)
-                            d_ipol = (d1 + d2) / 2;
-                        else
-                            d_ipol = min(d1, d2);
-
-                        // set all values to d_ipol
-                        for (int32_t v_curr = v_first; v_curr <= v_last; v_curr++)
-                            *(D + getAddressOffsetImage(u, v_curr, D_width)) = d_ipol;
+                // if disparity valid
+                if (*(D + addr) >= 0) {
+                    // check if gap is small enough
+                    if (count[i] >= 1 && count[i] <= D_ipol_gap_width) {
+                        // first and last value for interpolation
+                        v_first = v - count[i];
+                        v_last = v - 1;
+
+                        // if value in range
+                        if (v_first > 0 && v_last < D_height - 1) {
+                            // compute mean disparity
+                            d1 = *(D + getAddressOffsetImage(u, v_first - 1, D_width));
+                            d2 = *(D + getAddressOffsetImage(u, v_last + 1, D_width));
+                            if (fabs(d1 - d2) < discon_threshold)
+                                d_ipol = (d1 + d2) / 2;
+                            else
+                                d_ipol = min(d1, d2);
+
+                            // set all values to d_ipol
+                            for (int32_t v_curr = max(v_first, v_min); v_curr <= v_last; v_curr++)
+                                *(D_out + getAddressOffsetImage(u, v_curr, D_width)) = d_ipol;
+                        }
                     }
-                }
 
-                // reset counter
-                count = 0;
+                    // reset counter
+                    count[i] = 0;
+                    if (v >= v_max)
+                        count[i] = -1, open--;
 
-                // otherwise increment counter
-            } else {
-                count++;
+                    // otherwise increment counter
+                } else {
+                    count[i]++;
+                    if (v >= v_max && count[i] > D_ipol_gap_width)
+                        count[i] = -1, open--;
+                }
             }
         }
 
         // added extrapolation to top and bottom since bottom rows sometimes stay unlabeled...
         // DS 5/12/2014
 
-        // if full size disp map requested
+        // if full size disp map requested (only the rows from v_min to v_max are written, the
+        // scans stop where the extrapolation could not reach them anymore)
         if (param.add_corners) {
-            // extrapolate towards top
-            for (int32_t v = 0; v < D_height; v++) {
-                // get address of this location
-                addr = getAddressOffsetImage(u, v, D_width);
-
-                // if disparity valid
-                if (*(D + addr) >= 0) {
-                    for (int32_t v2 = max(v - D_ipol_gap_width, 0); v2 < v; v2++)
-                        *(D + getAddressOffsetImage(u, v2, D_width)) = *(D + addr);
-                    break;
-                }
+            // extrapolate towards top: first valid row of each column
+            v_end = min(v_max + D_ipol_gap_width, D_height);
+            for (int32_t i = 0; i < n; i++)
+                v_valid[i] = v_end;
+            open = n;
+            for (int32_t v = 0; v < v_end && open > 0; v++)
+                for (int32_t i = 0; i < n; i++)
+                    if (v_valid[i] == v_end && *(D + getAddressOffsetImage(u_block + i, v, D_width)) >= 0)
+                        v_valid[i] = v, open--;
+            for (int32_t i = 0; i < n; i++) {
+                if (v_valid[i] == v_end)
+                    continue;
+                addr = getAddressOffsetImage(u_block + i, v_valid[i], D_width);
+                for (int32_t v2 = max(v_valid[i] - D_ipol_gap_width, v_min); v2 < min(v_valid[i], v_max); v2++)
+                    *(D_out + getAddressOffsetImage(u_block + i, v2, D_width)) = *(D + addr);
             }
 
-            // extrapolate towards the bottom
-            for (int32_t v = D_height - 1; v >= 0; v--) {
-                // get address of this location
-                addr = getAddressOffsetImage(u, v, D_width);
-
-                // if disparity valid
-                if (*(D + addr) >= 0) {
-                    for (int32_t v2 = v; v2 <= min(v + D_ipol_gap_width, D_height - 1); v2++)
-                        *(D + getAddressOffsetImage(u, v2, D_width)) = *(D + addr);
-                    break;
-                }
+            // extrapolate towards the bottom: last valid row of each column
+            v_end = max(v_min - D_ipol_gap_width, 0) - 1;
+            for (int32_t i = 0; i < n; i++)
+                v_valid[i] = v_end;
+            open = n;
+            for (int32_t v = D_height - 1; v > v_end && open > 0; v--)
+                for (int32_t i = 0; i < n; i++)
+                    if (v_valid[i] == v_end && *(D + getAddressOffsetImage(u_block + i, v, D_width)) >= 0)
+                        v_valid[i] = v, open--;
+            for (int32_t i = 0; i < n; i++) {
+                if (v_valid[i] == v_end)
+                    continue;
+                addr = getAddressOffsetImage(u_block + i, v_valid[i], D_width);
+                for (int32_t v2 = max(v_valid[i], v_min); v2 <= min(v_valid[i] + D_ipol_gap_width, v_max - 1); v2++)
+                    *(D_out + getAddressOffsetImage(u_block + i, v2, D_width)) = *(D + addr);
             }
         }
     }
@@ -1295,6 +1344,25 @@ void Elas::gapInterpolation(float *D) {
 
 // implements approximation to bilateral filtering
 void Elas::adaptiveMean(float *D) {
+    // get disparity image dimensions
+    int32_t D_height = height;
+    if (param.subsampling)
+        D_height = height / 2;
+
+    // temporary memory
+    float *D_copy = ws.D_tmp1;
+    float *D_tmp = ws.D_tmp2;
+
+    // horizontal filter
+    for (int32_t v = 0; v < D_height; v++)
+        adaptiveMeanHorizontal(D, D_copy, D_tmp, v);
+
+    // vertical filter
+    for (int32_t v = 0; v < D_height; v++)
+        adaptiveMeanVertical(D_tmp, D, v);
+}
+
+void Elas::adaptiveMeanHorizontal(const float *D, float *D_copy, float *D_tmp, int32_t v) {
     // get disparity image dimensions
     int32_t D_width = width;
     int32_t D_height = height;
@@ -1303,197 +1371,75 @@ void Elas::adaptiveMean(float *D) {
         D_height = height / 2;
     }
 
-    // allocate temporary memory
-    float *D_copy = (float *)malloc(D_width * D_height * sizeof(float));
-    float *D_tmp = (float *)malloc(D_width * D_height * sizeof(float));
-    memcpy(D_copy, D, D_width * D_height * sizeof(float));
-
-    // zero input disparity maps to -10 (this makes the bilateral
-    // weights of all valid disparities to 0 in this region)
-    for (int32_t i = 0; i < D_width * D_height; i++) {
-        if (*(D + i) < 0) {
-            *(D_copy + i) = -10;
-            *(D_tmp + i) = -10;
-        }
+    // bilateral filter width: 4 pixels when doing subsampling, 8 pixels at full resolution
+    int32_t taps = param.subsampling ? 4 : 8;
+
+    // invalid input disparities are set to -10 (this makes the bilateral weights of all valid
+    // disparities 0 in this region) and pixels the filter does not reach keep their input value
+    uint32_t addr = getAddressOffsetImage(0, v, D_width);
+    for (int32_t u = 0; u < D_width; u++) {
+        float d = *(D + addr + u);
+        *(D_copy + addr + u) = *(D_tmp + addr + u) = d < 0 ? -10 : d;
     }
+    if (v >= 3 && v < D_height - 3)
+        filter::adaptiveMean(D_copy + addr + taps / 2, D_tmp + addr + taps / 2, 1, taps, D_width - taps + 1);
+}
 
-    __m128 xconst0 = _mm_set1_ps(0);
-    __m128 xconst4 = _mm_set1_ps(4);
-    __m128 xval, xweight1, xweight2, xfactor1, xfactor2;
+void Elas::adaptiveMeanVertical(const float *D_tmp, float *D, int32_t v) {
+    // get disparity image dimensions
+    int32_t D_width = width;
+    int32_t D_height = height;
+    if (param.subsampling) {
+        D_width = width / 2;
+        D_height = height / 2;
+    }
 
-    float *val = (float *)_mm_malloc(8 * sizeof(float), 16);
-    float *weight = (float *)_mm_malloc(4 * sizeof(float), 16);
-    float *factor = (float *)_mm_malloc(4 * sizeof(float), 16);
+    // the filter reads the rows v - taps / 2 to v + taps / 2 - 1
+    int32_t taps = param.subsampling ? 4 : 8;
+    if (v < taps / 2 || v >= D_height - taps / 2 + 1)
+        return;
+    uint32_t addr = getAddressOffsetImage(3, v, D_width);
+    filter::adaptiveMean(D_tmp + addr, D + addr, D_width, taps, D_width - 6);
+}
 
-    // set absolute mask
-    __m128 xabsmask = _mm_set1_ps(0x7FFFFFFF);
+void Elas::median(float *D) {
+    // get disparity image dimensions
+    int32_t D_height = height;
+    if (param.subsampling)
+        D_height = height / 2;
 
-    // when doing subsampling: 4 pixel bilateral filter width
-    if (param.subsampling) {
-        // horizontal filter
-        for (int32_t v = 3; v < D_height - 3; v++) {
-            // init
-            for (int32_t u = 0; u < 3; u++)
-                val[u] = *(D_copy + v * D_width + u);
-
-            // loop
-            for (int32_t u = 3; u < D_width; u++) {
-                // set
-                float val_curr = *(D_copy + v * D_width + (u - 1));
-                val[u % 4] = *(D_copy + v * D_width + u);
-
-                xval = _mm_load_ps(val);
-                xweight1 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
-                xweight1 = _mm_and_ps(xweight1, xabsmask);
-                xweight1 = _mm_sub_ps(xconst4, xweight1);
-                xweight1 = _mm_max_ps(xconst0, xweight1);
-                xfactor1 = _mm_mul_ps(xval, xweight1);
-
-                _mm_store_ps(weight, xweight1);
-                _mm_store_ps(factor, xfactor1);
-
-                float weight_sum = weight[0] + weight[1] + weight[2] + weight[3];
-                float factor_sum = factor[0] + factor[1] + factor[2] + factor[3];
-
-                if (weight_sum > 0) {
-                    float d = factor_sum / weight_sum;
-                    if (d >= 0)
-                        *(D_tmp + v * D_width + (u - 1)) = d;
-                }
-            }
-        }
+    // temporary memory
+    float *D_temp = ws.D_tmp1;
 
-        // vertical filter
-        for (int32_t u = 3; u < D_width - 3; u++) {
-            // init
-            for (int32_t v = 0; v < 3; v++)
-                val[v] = *(D_tmp + v * D_width + u);
-
-            // loop
-            for (int32_t v = 3; v < D_height; v++) {
-                // set
-                float val_curr = *(D_tmp + (v - 1) * D_width + u);
-                val[v % 4] = *(D_tmp + v * D_width + u);
-
-                xval = _mm_load_ps(val);
-                xweight1 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
-                xweight1 = _mm_and_ps(xweight1, xabsmask);
-                xweight1 = _mm_sub_ps(xconst4, xweight1);
-                xweight1 = _mm_max_ps(xconst0, xweight1);
-                xfactor1 = _mm_mul_ps(xval, xweight1);
-
-                _mm_store_ps(weight, xweight1);
-                _mm_store_ps(factor, xfactor1);
-
-                float weight_sum = weight[0] + weight[1] + weight[2] + weight[3];
-                float factor_sum = factor[0] + factor[1] + factor[2] + factor[3];
-
-                if (weight_sum > 0) {
-                    float d = factor_sum / weight_sum;
-                    if (d >= 0)
-                        *(D + (v - 1) * D_width + u) = d;
-                }
-            }
-        }
+    // first step: horizontal median filter
+    for (int32_t v = 0; v < D_height; v++)
+        medianHorizontal(D, D_temp, v);
 
-        // full resolution: 8 pixel bilateral filter width
-    } else {
-        // horizontal filter
-        for (int32_t v = 3; v < D_height - 3; v++) {
-            // init
-            for (int32_t u = 0; u < 7; u++)
-                val[u] = *(D_copy + v * D_width + u);
-
-            // loop
-            for (int32_t u = 7; u < D_width; u++) {
-                // set
-                float val_curr = *(D_copy + v * D_width + (u - 3));
-                val[u % 8] = *(D_copy + v * D_width + u);
-
-                xval = _mm_load_ps(val);
-                xweight1 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
-                xweight1 = _mm_and_ps(xweight1, xabsmask);
-                xweight1 = _mm_sub_ps(xconst4, xweight1);
-                xweight1 = _mm_max_ps(xconst0, xweight1);
-                xfactor1 = _mm_mul_ps(xval, xweight1);
-
-                xval = _mm_load_ps(val + 4);
-                xweight2 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
-                xweight2 = _mm_and_ps(xweight2, xabsmask);
-                xweight2 = _mm_sub_ps(xconst4, xweight2);
-                xweight2 = _mm_max_ps(xconst0, xweight2);
-                xfactor2 = _mm_mul_ps(xval, xweight2);
-
-                xweight1 = _mm_add_ps(xweight1, xweight2);
-                xfactor1 = _mm_add_ps(xfactor1, xfactor2);
-
-                _mm_store_ps(weight, xweight1);
-                _mm_store_ps(factor, xfactor1);
-
-                float weight_sum = weight[0] + weight[1] + weight[2] + weight[3];
-                float factor_sum = factor[0] + factor[1] + factor[2] + factor[3];
-
-                if (weight_sum > 0) {
-                    float d = factor_sum / weight_sum;
-                    if (d >= 0)
-                        *(D_tmp + v * D_width + (u - 3)) = d;
-                }
-            }
-        }
+    // second step: vertical median filter
+    for (int32_t v = 0; v < D_height; v++)
+        medianVertical(D_temp, D, v);
+}
 
-        // vertical filter
-        for (int32_t u = 3; u < D_width - 3; u++) {
-            // init
-            for (int32_t v = 0; v < 7; v++)
-                val[v] = *(D_tmp + v * D_width + u);
-
-            // loop
-            for (int32_t v = 7; v < D_height; v++) {
-                // set
-                float val_curr = *(D_tmp + (v - 3) * D_width + u);
-                val[v % 8] = *(D_tmp + v * D_width + u);
-
-                xval = _mm_load_ps(val);
-                xweight1 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
-                xweight1 = _mm_and_ps(xweight1, xabsmask);
-                xweight1 = _mm_sub_ps(xconst4, xweight1);
-                xweight1 = _mm_max_ps(xconst0, xweight1);
-                xfactor1 = _mm_mul_ps(xval, xweight1);
-
-                xval = _mm_load_ps(val + 4);
-                xweight2 = _mm_sub_ps(xval, _mm_set1_ps(val_curr));
-                xweight2 = _mm_and_ps(xweight2, xabsmask);
-                xweight2 = _mm_sub_ps(xconst4, xweight2);
-                xweight2 = _mm_max_ps(xconst0, xweight2);
-                xfactor2 = _mm_mul_ps(xval, xweight2);
-
-                xweight1 = _mm_add_ps(xweight1, xweight2);
-                xfactor1 = _mm_add_ps(xfactor1, xfactor2);
-
-                _mm_store_ps(weight, xweight1);
-                _mm_store_ps(factor, xfactor1);
-
-                float weight_sum = weight[0] + weight[1] + weight[2] + weight[3];
-                float factor_sum = factor[0] + factor[1] + factor[2] + factor[3];
-
-                if (weight_sum > 0) {
-                    float d = factor_sum / weight_sum;
-                    if (d >= 0)
-                        *(D + (v - 3) * D_width + u) = d;
-                }
-            }
-        }
+void Elas::medianHorizontal(const float *D, float *D_temp, int32_t v) {
+    // get disparity image dimensions
+    int32_t D_width = width;
+    int32_t D_height = height;
+    if (param.subsampling) {
+        D_width = width / 2;
+        D_height = height / 2;
     }
 
-    // free memory
-    _mm_free(val);
-    _mm_free(weight);
-    _mm_free(factor);
-    free(D_copy);
-    free(D_tmp);
+    // the rows the filter does not reach are zero (the vertical filter reads them)
+    int32_t window_size = 3;
+    uint32_t addr = getAddressOffsetImage(0, v, D_width);
+    if (v < window_size || v >= D_height - window_size || D_width <= 2 * window_size) {
+        memset(D_temp + addr, 0, D_width * sizeof(float));
+        return;
+    }
+    filter::median7(D + addr + window_size, D + addr + window_size, D_temp + addr + window_size, 1, D_width - 2 * window_size);
 }
 
-void Elas::median(float *D) {
+void Elas::medianVertical(const float *D_temp, float *D, int32_t v) {
     // get disparity image dimensions
     int32_t D_width = width;
     int32_t D_height = height;
@@ -1502,59 +1448,79 @@ void Elas::median(float *D) {
         D_height = height / 2;
     }
 
-    // temporary memory
-    float *D_temp = (float *)calloc(D_width * D_height, sizeof(float));
-
+    // the filter reads the rows v - window_size to v + window_size
     int32_t window_size = 3;
+    if (v < window_size || v >= D_height - window_size || D_width <= 2 * window_size)
+        return;
+    uint32_t addr = getAddressOffsetImage(window_size, v, D_width);
+    filter::median7(D_temp + addr, D + addr, D + addr, D_width, D_width - 2 * window_size);
+}
 
-    float *vals = new float[window_size * 2 + 1];
-    int32_t i, j;
-    float temp;
+void Elas::postProcessRows(const float *D_in, float *D, float *D_band, int32_t v_min, int32_t v_max) {
+    // get disparity image dimensions
+    int32_t D_width = width;
+    int32_t D_height = height;
+    if (param.subsampling) {
+        D_width = width / 2;
+        D_height = height / 2;
+    }
 
-    // first step: horizontal median filter
-    for (int32_t u = window_size; u < D_width - window_size; u++) {
-        for (int32_t v = window_size; v < D_height - window_size; v++) {
-            if (*(D + getAddressOffsetImage(u, v, D_width)) >= 0) {
-                j = 0;
-                for (int32_t u2 = u - window_size; u2 <= u + window_size; u2++) {
-                    temp = *(D + getAddressOffsetImage(u2, v, D_width));
-                    i = j - 1;
-                    while (i >= 0 && *(vals + i) > temp) {
-                        *(vals + i + 1) = *(vals + i);
-                        i--;
-                    }
-                    *(vals + i + 1) = temp;
-                    j++;
-                }
-                *(D_temp + getAddressOffsetImage(u, v, D_width)) = *(vals + window_size);
-            } else {
-                *(D_temp + getAddressOffsetImage(u, v, D_width)) = *(D + getAddressOffsetImage(u, v, D_width));
-            }
+    // rows above and below a row that the filters read
+    int32_t taps = param.subsampling ? 4 : 8;
+    int32_t mean_above = param.filter_adaptive_mean ? taps / 2 : 0;
+    int32_t mean_below = param.filter_adaptive_mean ? taps / 2 - 1 : 0;
+    int32_t median_reach = param.filter_median ? 3 : 0;
+
+    // the rows go through the steps in bands of postprocess_band rows, every step runs ahead of
+    // the next one as far as it reads; the three scratch images of D_band are addressed like
+    // disparity images holding the rows from v_base on, the rows still needed are shifted to the
+    // top when the next band does not fit (the input copies of the adaptive mean go to the rows
+    // of D_temp the median has not reached yet)
+    int32_t band_rows = postprocess_band + 2 * postprocess_halo;
+    int32_t band_size = band_rows * D_width;
+    int32_t v_base = max(v_min - mean_above - median_reach, 0);
+    int32_t gap_done = v_base, mean_done = max(v_min - median_reach, 0);
+    float *D_out = D_band - v_base * D_width;
+    float *D_tmp = D_out + band_size;
+    float *D_temp = D_tmp + band_size;
+
+    for (int32_t v = v_min; v < v_max; v += postprocess_band) {
+        int32_t v_end = min(v + postprocess_band, v_max);
+        int32_t mean_end = min(v_end + median_reach, D_height);
+        int32_t gap_end = min(mean_end + mean_below, D_height);
+        if (gap_end - v_base > band_rows) {
+            int32_t v_keep = v - postprocess_halo;
+            for (int32_t i = 0; i < 3; i++)
+                memmove(D_band + i * band_size, D_band + i * band_size + (v_keep - v_base) * D_width, (gap_done - v_keep) * D_width * sizeof(float));
+            v_base = v_keep;
+            D_out = D_band - v_base * D_width;
+            D_tmp = D_out + band_size;
+            D_temp = D_tmp + band_size;
         }
-    }
 
-    // second step: vertical median filter
-    for (int32_t u = window_size; u < D_width - window_size; u++) {
-        for (int32_t v = window_size; v < D_height - window_size; v++) {
-            if (*(D + getAddressOffsetImage(u, v, D_width)) >= 0) {
-                j = 0;
-                for (int32_t v2 = v - window_size; v2 <= v + window_size; v2++) {
-                    temp = *(D_temp + getAddressOffsetImage(u, v2, D_width));
-                    i = j - 1;
-                    while (i >= 0 && *(vals + i) > temp) {
-                        *(vals + i + 1) = *(vals + i);
-                        i--;
-                    }
-                    *(vals + i + 1) = temp;
-                    j++;
-                }
-                *(D + getAddressOffsetImage(u, v, D_width)) = *(vals + window_size);
-            } else {
-                *(D + getAddressOffsetImage(u, v, D_width)) = *(D + getAddressOffsetImage(u, v, D_width));
-            }
+        // column-wise gap interpolation (the gaps may reach beyond the band, D_in is complete),
+        // horizontal adaptive mean
+        memcpy(D_out + gap_done * D_width, D_in + gap_done * D_width, (gap_end - gap_done) * D_width * sizeof(float));
+        gapInterpolationColumns(D_in, D_out, gap_done, gap_end, 0, D_width);
+        if (param.filter_adaptive_mean)
+            for (int32_t v_curr = gap_done; v_curr < gap_end; v_curr++)
+                adaptiveMeanHorizontal(D_out, D_temp, D_tmp, v_curr);
+        gap_done = gap_end;
+
+        // vertical adaptive mean, horizontal median
+        for (int32_t v_curr = mean_done; v_curr < mean_end; v_curr++) {
+            if (param.filter_adaptive_mean)
+                adaptiveMeanVertical(D_tmp, D_out, v_curr);
+            if (param.filter_median)
+                medianHorizontal(D_out, D_temp, v_curr);
         }
-    }
+        mean_done = mean_end;
+
+        // vertical median
+        if (param.filter_median)
+            for (int32_t v_curr = v; v_curr < v_end; v_curr++)
+                medianVertical(D_temp, D_out, v_curr);
 
-    free(D_temp);
-    free(vals);
-}
\ No newline at end of file
+        memcpy(D + v * D_width, D_out + v * D_width, (v_end - v) * D_width * sizeof(float));
+    }
+}
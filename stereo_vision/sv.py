@@ -153,6 +153,21 @@ KITTI_FOLDER_PATH = os.path.join("/".join(__file__.split("/")[:-1]), 'data', 'ki
 
 SMOL_KITTI_FOLDER_PATH = os.path.join("/".join(__file__.split("/")[:-1]), 'data', 'kitti_smol')
 
+# Layouts of the points returned by generatePointCloud: the Reprojection::Format written by the shared library,
+# the matching dtype and the shape for n points. 'planes32' holds all x, then all y, then all z values.
+POINT_FORMATS = {
+    'xyz64': (0, np.float64, lambda n: (n, 3)),
+    'xyz32': (1, np.float32, lambda n: (n, 3)),
+    'xyz16': (2, np.float16, lambda n: (n, 3)),
+    'planes32': (3, np.float32, lambda n: (3, n)),
+}
+
+# Depth images of the shared library: the DepthLut::Format and the dtype of the 16 bit values
+DEPTH_FORMATS = {
+    'f16': (0, np.float16),
+    'mm16': (1, np.uint16),
+}
+
 class stereo_vision:
 
     def __init__(self, so_lib_path=DEFAULT_STEREO_VISION_SO_PATH, width=1242, height=375, 
@@ -160,11 +175,18 @@ class stereo_vision:
                 defaultCalibFile=True, objectTracking=True, graphics=False, display=False, scale=1, pc_extrapolation=1,
                 YOLO_CFG='src/yolo/yolov4-tiny.cfg', YOLO_WEIGHTS='src/yolo/yolov4-tiny.weights', YOLO_CLASSES='src/yolo/classes.txt',
                 CAMERA_CALIBRATION_YAML='data/calibration/kitti_2011_09_26.yml',
-                subsampling = False):
+                subsampling = False, temporal = False, min_depth = 0, max_depth = 0, ground_margin = 0, remove_sky = False, point_format = 'xyz64',
+                x_range = None, y_range = None, z_range = None, min_disparity = 0, depth_format = None):
         self.sv = ctypes.CDLL(so_lib_path)
         self.width = width
         self.height = height
-        self.sv.generatePointCloud.restype = ndpointer(dtype=ctypes.c_double, shape=(width*height,3))
+        # Without a point_format (e.g. with only a depth_format) no point cloud is computed or returned
+        self.point_format, self.point_planes = -1, False
+        self.sv.generatePointCloud.restype = ctypes.c_void_p
+        if point_format is not None:
+            self.point_format, point_dtype, point_shape = POINT_FORMATS[point_format]
+            self.point_planes = point_format == 'planes32'
+            self.sv.generatePointCloud.restype = ndpointer(dtype=point_dtype, shape=point_shape(width*height))
         
         self.defaultCalibFile = defaultCalibFile
         self.objectTracking = objectTracking
@@ -177,7 +199,28 @@ class stereo_vision:
         self.YOLO_WEIGHTS = YOLO_WEIGHTS
         self.YOLO_CLASSES = YOLO_CLASSES
         self.CAMERA_CALIBRATION_YAML = CAMERA_CALIBRATION_YAML
-        self.sv.generatePointCloud.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_bool, ctypes.c_bool, ctypes.c_bool, ctypes.c_bool, ctypes.c_int, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p]
+        self.subsampling = subsampling
+        self.temporal = temporal
+        self.min_depth = min_depth
+        self.max_depth = max_depth
+        self.ground_margin = ground_margin
+        self.remove_sky = remove_sky
+        # With limits, only the points inside (exclusive ranges, disparity map values of at least min_disparity) are returned
+        self.min_disparity = min_disparity
+        self.point_range = None
+        if x_range is not None or y_range is not None or z_range is not None:
+            unbounded = (-np.inf, np.inf)
+            self.point_range = (ctypes.c_float * 6)(*(x_range or unbounded), *(y_range or unbounded), *(z_range or unbounded))
+        self.sv.getPointCount.restype = ctypes.c_int
+        self.sv.setTopView.argtypes = [ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.c_float, ctypes.c_float]
+        self.sv.getTopView.restype = ctypes.POINTER(ctypes.c_float)
+        self.top_view_enabled = False
+        self.sv.getDepthImage.restype = ctypes.POINTER(ctypes.c_uint16)
+        self.depth_dtype = None
+        if depth_format is not None:
+            depth_format, self.depth_dtype = DEPTH_FORMATS[depth_format]
+            self.sv.setDepthImage(depth_format)
+        self.sv.generatePointCloud.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_bool, ctypes.c_bool, ctypes.c_bool, ctypes.c_bool, ctypes.c_int, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_bool, ctypes.c_bool, ctypes.c_bool, ctypes.c_float, ctypes.c_float, ctypes.c_int, ctypes.c_int, ctypes.POINTER(ctypes.c_float), ctypes.c_int]
         print(self.sv.generatePointCloud.argtypes)
         print(CAMERA_CALIBRATION_YAML)
 
@@ -186,8 +229,46 @@ class stereo_vision:
         right = cv2.cvtColor(right, cv2.COLOR_BGR2BGRA)
         left = left.tostring()
         right = right.tostring()
-        return self.sv.generatePointCloud(left, right, self.CAMERA_CALIBRATION_YAML.encode('utf-8'), self.width, self.height, self.defaultCalibFile, self.objectTracking, self.graphics, self.display, self.scale, self.pc_extrapolation,self.YOLO_CFG.encode('utf-8'), self.YOLO_WEIGHTS.encode('utf-8'), self.YOLO_CLASSES.encode('utf-8'))
+        points = self.sv.generatePointCloud(left, right, self.CAMERA_CALIBRATION_YAML.encode('utf-8'), self.width, self.height, self.defaultCalibFile, self.objectTracking, self.graphics, self.display, self.scale, self.pc_extrapolation,self.YOLO_CFG.encode('utf-8'), self.YOLO_WEIGHTS.encode('utf-8'), self.YOLO_CLASSES.encode('utf-8'), bool(self.remove_sky), bool(self.subsampling), self.temporal, self.min_depth, self.max_depth, self.ground_margin, self.point_format, self.point_range, self.min_disparity)
+        if self.point_format < 0:
+            return None
+        if self.point_range is None and self.min_disparity <= 0:
+            return points
+        # the kept points are at the front of the buffer (of every plane for 'planes32')
+        count = self.sv.getPointCount()
+        return points[:, :count] if self.point_planes else points[:count]
     
+    def enable_top_view(self, x_range, y_range, z_range, scale, hit_probability = 0.3):
+        """ Rasterizes the points of every following frame into a bird's eye view grid, like points_2_top_view """
+        bounds = lambda r: (ctypes.c_float * 2)(*r)
+        self.sv.setTopView(bounds(x_range), bounds(y_range), bounds(z_range), scale, hit_probability)
+        self.top_view_enabled = True
+
+    def top_view(self):
+        """
+        (max height, min height, density, occupancy) x rows x cols float32 grid of the last frame
+        A view of the buffer of the library without a copy, the next frame overwrites it, None before enable_top_view
+        """
+        if not self.top_view_enabled:
+            return None
+        rows, cols = ctypes.c_int(), ctypes.c_int()
+        grid = self.sv.getTopView(ctypes.byref(rows), ctypes.byref(cols))
+        return np.ctypeslib.as_array(grid, shape=(4, rows.value, cols.value))
+
+    def depth_image(self):
+        """
+        Depth of every pixel of the disparity map of the last frame (0: no disparity), a view without a copy
+        float16 in meters ('f16') or uint16 in millimeters ('mm16') for KITTI, the next frame overwrites it
+        Half the width and height of the images with subsampling, None without a depth_format or before the first frame
+        """
+        if self.depth_dtype is None:
+            return None
+        width, height = ctypes.c_int(), ctypes.c_int()
+        depth = self.sv.getDepthImage(ctypes.byref(width), ctypes.byref(height))
+        if not depth:
+            return None
+        return np.ctypeslib.as_array(depth, shape=(height.value, width.value)).view(self.depth_dtype)
+
     def __del__(self):
         self.sv.clean()
 
@@ -198,6 +279,11 @@ def main():
     parser = argparse.ArgumentParser(description='stereo_vision CLI for disparity calculation and 3D depth map generation from a stereo pair')
     parser.add_argument('-k', '--kitti', type=str, default='~/KITTI', help='Path to KITTI directory of test images')
     parser.add_argument('-s', '--subsampling', type=int, default=0, help='Set s=1 for evaluating only every second pixel')
+    parser.add_argument('-T', '--temporal', default=False, action='store_true', help='Warm-starts the support matching of every frame from the previous one')
+    parser.add_argument('-n', '--min_depth', type=float, default=0, help='Nearest depth (meters for KITTI) that needs a disparity, limits the disparity search (0: no limit)')
+    parser.add_argument('-m', '--max_depth', type=float, default=0, help='Farthest depth that needs a disparity, limits the disparity search (0: no limit)')
+    parser.add_argument('-g', '--ground_margin', type=int, default=0, help='Searches no disparities below the ground plane of the calibration (XR, XT) minus this margin in every row (0: off)')
+    parser.add_argument('-r', '--remove_sky', default=False, action='store_true', help='Only matches the lower 45 %% of the image, below the sky')
     parser.add_argument('-f', '--scale', type=int, default=1, help='By what factor to scale down the image by')
     parser.add_argument('-p', '--pointcloud_interpolation', default=False, action='store_true', help='Interpolates the point cloud to the desired scale')
     
@@ -220,6 +306,11 @@ def main():
     scale_factor = args.scale #int(sys.argv[2])
     pc_extrapolation = args.pointcloud_interpolation# int(sys.argv[3])
     subsampling = args.subsampling
+    temporal = args.temporal
+    min_depth = args.min_depth
+    max_depth = args.max_depth
+    ground_margin = args.ground_margin
+    remove_sky = args.remove_sky
     
     so_file_path = DEFAULT_STEREO_VISION_SO_PATH
     if args.parallel:
@@ -244,7 +335,7 @@ def main():
             download_file('https://s3.eu-central-1.amazonaws.com/avg-kitti/data_scene_flow.zip', KITTI_ZIP_PATH)
             unzip_file(KITTI_ZIP_PATH, KITTI_FOLDER_PATH)
             
-            s = stereo_vision(width=1242//scale_factor, height=375//scale_factor, objectTracking=False, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, CAMERA_CALIBRATION_YAML = CAMERA_CALIBRATION_YAML, so_lib_path=so_file_path, subsampling = subsampling)
+            s = stereo_vision(width=1242//scale_factor, height=375//scale_factor, objectTracking=False, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, CAMERA_CALIBRATION_YAML = CAMERA_CALIBRATION_YAML, so_lib_path=so_file_path, subsampling = subsampling, temporal = temporal, min_depth = min_depth, max_depth = max_depth, ground_margin = ground_margin, remove_sky = remove_sky)
             #s = stereo_vision(width=1242//scale_factor, height=375//scale_factor, objectTracking=True, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, YOLO_CFG=YOLO_CFG, YOLO_WEIGHTS=YOLO_WEIGHTS, YOLO_CLASSES=YOLO_CLASSES, so_lib_path=so_file_path, subsampling = subsampling)
 
             image_files = sorted(os.listdir(os.path.join(KITTI_FOLDER_PATH, 'testing', 'image_2')))
@@ -263,7 +354,7 @@ def main():
 
             clone_repo('https://github.com/AdityaNG/Mini_Stereo_Dataset.git', SMOL_KITTI_FOLDER_PATH)
             
-            s = stereo_vision(width=1242//scale_factor, height=375//scale_factor, objectTracking=False, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, CAMERA_CALIBRATION_YAML = CAMERA_CALIBRATION_YAML, so_lib_path = so_file_path, subsampling = subsampling)
+            s = stereo_vision(width=1242//scale_factor, height=375//scale_factor, objectTracking=False, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, CAMERA_CALIBRATION_YAML = CAMERA_CALIBRATION_YAML, so_lib_path = so_file_path, subsampling = subsampling, temporal = temporal, min_depth = min_depth, max_depth = max_depth, ground_margin = ground_margin, remove_sky = remove_sky)
             #s = stereo_vision(width=1242//scale_factor, height=375//scale_factor, objectTracking=True, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, YOLO_CFG=YOLO_CFG, YOLO_WEIGHTS=YOLO_WEIGHTS, YOLO_CLASSES=YOLO_CLASSES, so_lib_path=so_file_path, subsampling = subsampling)
 
             image_files = sorted(os.listdir(os.path.join(SMOL_KITTI_FOLDER_PATH, 'smol_kitti', 'image_02')))
@@ -279,9 +370,9 @@ def main():
 
     elif args.camera_to_use == -1:
         if OBJ_TRACK:
-            s = stereo_vision(width=1242//scale_factor, height=375//scale_factor, objectTracking=OBJ_TRACK, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, YOLO_CFG=YOLO_CFG, YOLO_WEIGHTS=YOLO_WEIGHTS, YOLO_CLASSES=YOLO_CLASSES, so_lib_path=so_file_path, subsampling = subsampling)
+            s = stereo_vision(width=1242//scale_factor, height=375//scale_factor, objectTracking=OBJ_TRACK, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, YOLO_CFG=YOLO_CFG, YOLO_WEIGHTS=YOLO_WEIGHTS, YOLO_CLASSES=YOLO_CLASSES, so_lib_path=so_file_path, subsampling = subsampling, temporal = temporal, min_depth = min_depth, max_depth = max_depth, ground_margin = ground_margin, remove_sky = remove_sky)
         else:
-            s = stereo_vision(width=1242//scale_factor, height=375//scale_factor, objectTracking=False, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, CAMERA_CALIBRATION_YAML = CAMERA_CALIBRATION_YAML, so_lib_path=so_file_path, subsampling = subsampling)
+            s = stereo_vision(width=1242//scale_factor, height=375//scale_factor, objectTracking=False, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, CAMERA_CALIBRATION_YAML = CAMERA_CALIBRATION_YAML, so_lib_path=so_file_path, subsampling = subsampling, temporal = temporal, min_depth = min_depth, max_depth = max_depth, ground_margin = ground_margin, remove_sky = remove_sky)
     
     
         for iFrame in range(465):
@@ -311,7 +402,7 @@ def main():
 
         h, w, d = left.shape
 
-        s = stereo_vision(width=w//scale_factor, height=h//scale_factor, objectTracking=False, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, CAMERA_CALIBRATION_YAML = CAMERA_CALIBRATION_YAML, so_lib_path=so_file_path, subsampling = subsampling)
+        s = stereo_vision(width=w//scale_factor, height=h//scale_factor, objectTracking=False, display=True, graphics=True, scale=scale_factor, pc_extrapolation=pc_extrapolation, CAMERA_CALIBRATION_YAML = CAMERA_CALIBRATION_YAML, so_lib_path=so_file_path, subsampling = subsampling, temporal = temporal, min_depth = min_depth, max_depth = max_depth, ground_margin = ground_margin, remove_sky = remove_sky)
         
         while True:
             camL.grab()
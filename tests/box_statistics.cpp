@@ -0,0 +1,115 @@
+// Check of BoxStatistics (pointcloud/box_statistics.*) against brute force over the pixels of random boxes:
+// the number of points must be exact, the mean point equal up to rounding, and the median disparity must be
+// the interpolated one of the histogram of the box and lie in the bin of the exact median. The tables are
+// built with random splits of both passes, in random order, as threads would share them. Pixels without a
+// disparity get points of NaN, which must never reach a sum.
+//
+// build: make box_statistics_test serial=1
+// run:   ./build/bin/box_statistics_test [number of random images]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "../src/common_includes/pointcloud/box_statistics.h"
+
+// splits 0..size into random ranges, in random order
+static std::vector<std::pair<int32_t, int32_t>> randomRanges(std::mt19937 &rng, int32_t size) {
+    std::vector<std::pair<int32_t, int32_t>> ranges;
+    for (int32_t begin = 0; begin < size;) {
+        int32_t end = std::min(size, begin + 1 + (int32_t)(rng() % 16));
+        ranges.push_back({begin, end});
+        begin = end;
+    }
+    std::shuffle(ranges.begin(), ranges.end(), rng);
+    return ranges;
+}
+
+int main(int argc, char **argv) {
+    int32_t images = argc > 1 ? atoi(argv[1]) : 100;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    const double bin_width = 256.0 / BoxStatistics::bins;
+    int32_t checks = 0, failures = 0;
+    double max_error = 0;
+    BoxStatistics box_statistics;
+    for (int32_t s = 0; s < images; s++) {
+        int32_t width = s == 0 ? 1242 : 1 + (int32_t)(uniform(rng) * 300), height = s == 0 ? 375 : 1 + (int32_t)(uniform(rng) * 100);
+        int32_t D_step = width + (s % 3) * 7;
+        double invalid = uniform(rng);
+        std::vector<uint8_t> D(D_step * height);
+        std::vector<double> points(3 * width * height);
+        for (int32_t v = 0; v < height; v++) {
+            for (int32_t u = 0; u < width; u++) {
+                uint8_t d = uniform(rng) < invalid ? 0 : 1 + (uint8_t)(uniform(rng) * 255);
+                D[v * D_step + u] = d;
+                for (int32_t k = 0; k < 3; k++)
+                    points[3 * (v * width + u) + k] = d ? (uniform(rng) - 0.5) * 2000 : NAN;
+            }
+        }
+
+        box_statistics.init(width, height);
+        for (auto &rows : randomRanges(rng, height))
+            box_statistics.sumRows(D.data(), D_step, points.data(), rows.first, rows.second);
+        for (auto &columns : randomRanges(rng, width))
+            box_statistics.sumColumns(columns.first, columns.second);
+
+        for (int32_t b = 0; b < 50; b++) {
+            // random boxes, the whole image and empty ones
+            int32_t u_min = uniform(rng) * width, v_min = uniform(rng) * height;
+            int32_t u_max = u_min + (int32_t)(uniform(rng) * (width - u_min + 1)), v_max = v_min + (int32_t)(uniform(rng) * (height - v_min + 1));
+            if (b == 0)
+                u_min = v_min = 0, u_max = width, v_max = height;
+
+            int32_t n = 0, histogram[BoxStatistics::bins] = {0};
+            double sum[3] = {0, 0, 0};
+            std::vector<uint8_t> disparities;
+            for (int32_t v = v_min; v < v_max; v++) {
+                for (int32_t u = u_min; u < u_max; u++) {
+                    uint8_t d = D[v * D_step + u];
+                    if (d == 0)
+                        continue;
+                    n++;
+                    for (int32_t k = 0; k < 3; k++)
+                        sum[k] += points[3 * (v * width + u) + k];
+                    histogram[(int32_t)(d / bin_width)]++;
+                    disparities.push_back(d);
+                }
+            }
+
+            bool ok = box_statistics.count(u_min, v_min, u_max, v_max) == n;
+            double xyz[3];
+            ok = ok && box_statistics.mean(u_min, v_min, u_max, v_max, xyz) == (n > 0);
+            for (int32_t k = 0; ok && k < 3 && n > 0; k++) {
+                double error = fabs(xyz[k] - sum[k] / n);
+                max_error = std::max(max_error, error);
+                ok = error < 1e-9;
+            }
+
+            // median: the bin where the cumulative histogram reaches n / 2, interpolated, and the exact (lower) median in that bin
+            double median = BoxStatistics::medianDisparity(D.data(), D_step, u_min, v_min, u_max, v_max);
+            if (n == 0) {
+                ok = ok && median == -1;
+            } else {
+                int32_t below = 0, k = 0;
+                while (2 * (below + histogram[k]) < n)
+                    below += histogram[k++];
+                std::nth_element(disparities.begin(), disparities.begin() + (n - 1) / 2, disparities.end());
+                int32_t exact = disparities[(n - 1) / 2];
+                ok = ok && median == bin_width * (k + (0.5 * n - below) / histogram[k]) && (int32_t)(exact / bin_width) == k;
+            }
+
+            checks++;
+            if (!ok) {
+                failures++;
+                printf("image %d (%dx%d), box %d..%d x %d..%d: the statistics differ from brute force\n", s, width, height, u_min, u_max, v_min,
+                       v_max);
+            }
+        }
+    }
+    printf("%d boxes, %d differ from brute force (largest error of a mean coordinate %.1e)\n", checks, failures, max_error);
+    return failures ? 1 : 0;
+}
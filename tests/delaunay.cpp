@@ -0,0 +1,192 @@
+// Check of the lattice Delaunay triangulation (common_includes/elas/delaunay.*) against brute force
+// and against the general purpose triangulator of triangle.cpp it replaces. The point sets are random
+// subsets of the support point lattice, as in the left image or shifted by integer disparities as in
+// the right one, with the image corners and duplicates. For every set the triangulation must
+//   - use every point but the duplicates as a vertex and only counter-clockwise triangles,
+//   - cover the convex hull (2 n - 2 - h triangles for n points, h of them on the hull),
+//   - be Delaunay: no point strictly inside the circumcircle of any triangle (checked exhaustively).
+// The smallest angles are compared with the ones of triangle(), both are timed on KITTI sized sets.
+//
+// build: make delaunay_test serial=1
+// run:   ./build/bin/delaunay_test [number of random sets]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "../src/common_includes/elas/delaunay.h"
+#include "../src/common_includes/elas/triangle.h"
+
+using namespace std;
+
+static int64_t orient(const int32_t *u, const int32_t *v, int32_t a, int32_t b, int32_t c) {
+    return (int64_t)(u[b] - u[a]) * (v[c] - v[a]) - (int64_t)(v[b] - v[a]) * (u[c] - u[a]);
+}
+
+static int64_t inCircle(const int32_t *u, const int32_t *v, int32_t a, int32_t b, int32_t c, int32_t d) {
+    int64_t adx = u[a] - u[d], ady = v[a] - v[d], bdx = u[b] - u[d], bdy = v[b] - v[d], cdx = u[c] - u[d], cdy = v[c] - v[d];
+    return (adx * adx + ady * ady) * (bdx * cdy - cdx * bdy) + (bdx * bdx + bdy * bdy) * (cdx * ady - adx * cdy) +
+           (cdx * cdx + cdy * cdy) * (adx * bdy - bdx * ady);
+}
+
+// number of distinct points on the boundary of the convex hull, collinear ones included
+static int32_t hullPoints(vector<pair<int32_t, int32_t>> p) {
+    sort(p.begin(), p.end());
+    p.erase(unique(p.begin(), p.end()), p.end());
+    auto cross = [](pair<int32_t, int32_t> o, pair<int32_t, int32_t> a, pair<int32_t, int32_t> b) {
+        return (int64_t)(a.first - o.first) * (b.second - o.second) - (int64_t)(a.second - o.second) * (b.first - o.first);
+    };
+    vector<pair<int32_t, int32_t>> h(2 * p.size());
+    int32_t k = 0;
+    for (size_t i = 0; i < p.size(); i++) {
+        while (k >= 2 && cross(h[k - 2], h[k - 1], p[i]) < 0)
+            k--;
+        h[k++] = p[i];
+    }
+    for (int32_t i = (int32_t)p.size() - 2, t = k + 1; i >= 0; i--) {
+        while (k >= t && cross(h[k - 2], h[k - 1], p[i]) < 0)
+            k--;
+        h[k++] = p[i];
+    }
+    return k - 1;
+}
+
+// smallest angle (radians) of every triangle, ascending
+static vector<double> minAngles(const int32_t *u, const int32_t *v, const vector<int32_t> &tri) {
+    vector<double> angles;
+    for (size_t k = 0; k < tri.size(); k += 3) {
+        double best = M_PI;
+        for (int32_t i = 0; i < 3; i++) {
+            int32_t a = tri[k + i], b = tri[k + (i + 1) % 3], c = tri[k + (i + 2) % 3];
+            double ab = atan2(v[b] - v[a], u[b] - u[a]), ac = atan2(v[c] - v[a], u[c] - u[a]);
+            double angle = fabs(ab - ac);
+            best = min(best, min(angle, 2 * M_PI - angle));
+        }
+        angles.push_back(best);
+    }
+    sort(angles.begin(), angles.end());
+    return angles;
+}
+
+static vector<int32_t> triangleReference(const int32_t *u, const int32_t *v, int32_t n) {
+    vector<float> pointlist(2 * n);
+    for (int32_t i = 0; i < n; i++) {
+        pointlist[2 * i] = u[i];
+        pointlist[2 * i + 1] = v[i];
+    }
+    struct triangulateio in = {}, out = {};
+    in.numberofpoints = n;
+    in.pointlist = pointlist.data();
+    char parameters[] = "zQB";
+    triangulate(parameters, &in, &out, NULL);
+    vector<int32_t> tri(out.trianglelist, out.trianglelist + 3 * out.numberoftriangles);
+    free(out.pointlist);
+    free(out.trianglelist);
+    return tri;
+}
+
+// support points on the lattice of an image of width x height: every candidate with probability
+// density, the four corners, in the right image shifted by a smooth disparity plus noise
+static void randomSupport(mt19937 &rng, int32_t width, int32_t height, int32_t step, double density, bool right, vector<int32_t> &u,
+                          vector<int32_t> &v) {
+    u.clear();
+    v.clear();
+    uniform_real_distribution<double> uniform(0, 1);
+    int32_t d_max = 1 + (int32_t)(uniform(rng) * 64);
+    for (int32_t y = step; y < height - step; y += step)
+        for (int32_t x = step; x < width - step; x += step)
+            if (uniform(rng) < density) {
+                int32_t d = right ? (int32_t)(d_max * (double)y / height + uniform(rng) * 4) : 0;
+                u.push_back(max(x - d, 0));
+                v.push_back(y);
+            }
+    for (int32_t c = 0; c < 4; c++) {
+        u.push_back(c & 1 ? width - 1 : 0);
+        v.push_back(c & 2 ? height - 1 : 0);
+    }
+}
+
+int main(int argc, char **argv) {
+    int32_t sets = argc > 1 ? atoi(argv[1]) : 3000;
+    mt19937 rng(1);
+    uniform_int_distribution<int32_t> size(2, 40);
+    Delaunay delaunay;
+    vector<int32_t> u, v;
+    int32_t failures = 0, better = 0, equal = 0, worse = 0;
+    for (int32_t s = 0; s < sets; s++) {
+        int32_t step = 1 + s % 5;
+        randomSupport(rng, size(rng) * step, size(rng) * step, step, 0.05 + 0.9 * (s % 10) / 10, s % 2, u, v);
+        int32_t n = u.size();
+        delaunay.triangulate(u.data(), v.data(), n);
+        const vector<int32_t> &tri = delaunay.triangles;
+
+        vector<pair<int32_t, int32_t>> points;
+        for (int32_t i = 0; i < n; i++)
+            points.push_back({u[i], v[i]});
+        vector<pair<int32_t, int32_t>> distinct = points;
+        sort(distinct.begin(), distinct.end());
+        distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+        int32_t n_distinct = distinct.size(), h = hullPoints(points);
+
+        // vertices: one per distinct point
+        vector<bool> used(n, false);
+        for (int32_t i : tri)
+            used[i] = true;
+        vector<pair<int32_t, int32_t>> vertices;
+        for (int32_t i = 0; i < n; i++)
+            if (used[i])
+                vertices.push_back(points[i]);
+        sort(vertices.begin(), vertices.end());
+        bool ok = vertices == distinct && (int32_t)tri.size() / 3 == 2 * n_distinct - 2 - h;
+        for (size_t k = 0; ok && k < tri.size(); k += 3) {
+            ok = orient(u.data(), v.data(), tri[k], tri[k + 1], tri[k + 2]) > 0;
+            for (int32_t i = 0; ok && i < n; i++)
+                ok = inCircle(u.data(), v.data(), tri[k], tri[k + 1], tri[k + 2], i) <= 0;
+        }
+        if (!ok) {
+            if (failures++ < 10)
+                printf("set %d: %d points (%d distinct, %d on the hull), %d triangles: not a Delaunay triangulation\n", s, n, n_distinct, h,
+                       (int32_t)tri.size() / 3);
+            continue;
+        }
+
+        // triangle() needs distinct points
+        vector<int32_t> u_distinct, v_distinct;
+        for (auto &p : distinct) {
+            u_distinct.push_back(p.first);
+            v_distinct.push_back(p.second);
+        }
+        vector<double> reference = minAngles(u_distinct.data(), v_distinct.data(), triangleReference(u_distinct.data(), v_distinct.data(), n_distinct));
+        vector<double> lattice = minAngles(u.data(), v.data(), tri);
+        if (lattice > reference)
+            better++;
+        else if (lattice == reference)
+            equal++;
+        else
+            worse++;
+    }
+    printf("%d random sets: %d failed, sorted smallest angles against triangle(): %d better, %d equal, %d worse\n", sets, failures, better,
+           equal, worse);
+
+    // timing on the support points of a KITTI image (1242x375, candidate step 5, about half of them matched)
+    for (int32_t right = 0; right < 2; right++) {
+        randomSupport(rng, 1242, 375, 5, 0.5, right, u, v);
+        int32_t n = u.size(), reps = 20;
+        auto t0 = chrono::steady_clock::now();
+        for (int32_t r = 0; r < reps; r++)
+            delaunay.triangulate(u.data(), v.data(), n);
+        auto t1 = chrono::steady_clock::now();
+        for (int32_t r = 0; r < reps; r++)
+            triangleReference(u.data(), v.data(), n);
+        auto t2 = chrono::steady_clock::now();
+        double lattice_ms = chrono::duration<double, milli>(t1 - t0).count() / reps;
+        double reference_ms = chrono::duration<double, milli>(t2 - t1).count() / reps;
+        printf("%s image, %d points: lattice %.2f ms, triangle() %.2f ms (%.2fx)\n", right ? "right" : "left", n, lattice_ms, reference_ms,
+               reference_ms / lattice_ms);
+    }
+    return failures ? 1 : 0;
+}
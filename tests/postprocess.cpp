@@ -0,0 +1,67 @@
+// Check of the fused post processing of libelas (parameters::postprocess_fused, Elas::postProcessFused)
+// against the image wide chain of L/R consistency check, speckle removal, gap interpolation, adaptive mean
+// and median it is an alternative to: both must give bit-identical disparity maps. Every image pair of
+// datasets/profile is matched with both settings, with and without subsampling, add_corners, the filters
+// and the post processing of the right image.
+//
+// build: make postprocess_test serial=1   (or omp=1)
+// run:   ./build/bin/postprocess_test [repository root]
+
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/common_includes/image.h"
+#include "elas.h"
+
+int main(int argc, char **argv) {
+    std::string root = argc > 1 ? argv[1] : ".";
+    const char *names[] = {"cones", "aloe", "raindeer", "urban1", "urban2", "urban3", "urban4"};
+    int32_t checks = 0, failures = 0;
+    for (const char *name : names) {
+        std::string prefix = root + "/datasets/profile/" + name;
+        image<uchar> *I1 = loadPGM((prefix + "_left.pgm").c_str());
+        image<uchar> *I2 = loadPGM((prefix + "_right.pgm").c_str());
+        int32_t width = I1->width(), height = I1->height();
+        const int32_t dims[3] = {width, height, width};
+
+        // bit 0: MIDDLEBURY, 1: subsampling, 2: right image post processed, 3: filters off
+        for (int32_t mode = 0; mode < 16; mode++) {
+            Elas::parameters param(mode & 1 ? Elas::MIDDLEBURY : Elas::ROBOTICS);
+            param.subsampling = mode & 2;
+            param.postprocess_only_left = !(mode & 4);
+            if (mode & 8) {
+                param.filter_median = false;
+                param.filter_adaptive_mean = false;
+            } else {
+                param.filter_median = true;
+                param.filter_adaptive_mean = true;
+            }
+            int32_t D_size = param.subsampling ? (width / 2) * (height / 2) : width * height;
+
+            std::vector<float> D[2][2];
+            for (int32_t fused = 0; fused < 2; fused++) {
+                param.postprocess_fused = fused;
+                Elas elas(param);
+                D[fused][0].resize(D_size);
+                D[fused][1].resize(D_size);
+                elas.process(I1->data, I2->data, D[fused][0].data(), D[fused][1].data(), dims);
+            }
+
+            for (int32_t i = 0; i < (param.postprocess_only_left ? 1 : 2); i++) {
+                checks++;
+                if (memcmp(D[0][i].data(), D[1][i].data(), D_size * sizeof(float))) {
+                    failures++;
+                    printf("%s %s, %s%s%s%s: the fused post processing differs\n", name, i ? "right" : "left", mode & 1 ? "MIDDLEBURY" : "ROBOTICS",
+                           mode & 2 ? ", subsampling" : "", mode & 4 ? ", both images" : "", mode & 8 ? ", no filters" : "");
+                }
+            }
+        }
+        delete I1;
+        delete I2;
+    }
+    printf("%d disparity maps, %d differ between the fused and the image wide post processing\n", checks, failures);
+    return failures ? 1 : 0;
+}
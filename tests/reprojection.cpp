@@ -0,0 +1,139 @@
+// Check of the compacting reprojection (Reprojection::reprojectRowsCompact and packRows) against the dense
+// output of reprojectRows filtered afterwards: for every point format, for random limits and for several
+// splits of the rows (all rows at once, one row per call followed by packRows as in the OpenMP build, random
+// row ranges), the kept points must be byte for byte the ones of the dense output, in the same order.
+// The disparity images are random, of even and odd widths and with padded lines.
+//
+// build: make reprojection_test serial=1
+// run:   ./build/bin/reprojection_test [number of random images]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include "../src/common_includes/pointcloud/reprojection.h"
+
+static const char *format_names[] = {"XYZ_F64", "XYZ_F32", "XYZ_F16", "PLANES_F32"};
+
+// bytes of the point i of a dense output (PLANES_F32: x, y and z from their planes)
+static void pointBytes(const uint8_t *points, size_t i, size_t plane, Reprojection::Format format, uint8_t *bytes) {
+    if (format == Reprojection::PLANES_F32) {
+        for (int32_t k = 0; k < 3; k++)
+            memcpy(bytes + 4 * k, points + 4 * (k * plane + i), 4);
+    } else
+        memcpy(bytes, points + i * Reprojection::pointSize(format), Reprojection::pointSize(format));
+}
+
+// the points n_first.. of a compact output against the expected ones
+static bool samePoints(const uint8_t *points, size_t plane, Reprojection::Format format, size_t first, const std::vector<uint8_t> &expected,
+                       size_t n_first, size_t n) {
+    int32_t size = Reprojection::pointSize(format);
+    uint8_t bytes[24];
+    for (size_t i = 0; i < n; i++) {
+        pointBytes(points, first + i, plane, format, bytes);
+        if (memcmp(bytes, expected.data() + (n_first + i) * size, size))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int32_t images = argc > 1 ? atoi(argv[1]) : 200;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    int32_t checks = 0, failures = 0;
+    for (int32_t s = 0; s < images; s++) {
+        // image size, line padding and disparities (a share of them 0, i.e. without a point)
+        int32_t width = s == 0 ? 1242 : 1 + (int32_t)(uniform(rng) * 200), height = s == 0 ? 375 : 1 + (int32_t)(uniform(rng) * 60);
+        int32_t D_step = width + (s % 3) * 5;
+        std::vector<uint8_t> D(D_step * height);
+        for (uint8_t &d : D)
+            d = uniform(rng) < 0.2 ? 0 : (uint8_t)(uniform(rng) * 256);
+
+        // stereoRectify-like Q (focal length, principal point, baseline) and a robot frame rotated about z and x
+        double f = 300 + uniform(rng) * 600, cx = width * (0.4 + 0.2 * uniform(rng)), cy = height * (0.4 + 0.2 * uniform(rng));
+        double Q[16] = {1, 0, 0, -cx, 0, 1, 0, -cy, 0, 0, 0, f, 0, 0, 1 / (0.1 + uniform(rng)), 0};
+        double a = uniform(rng) * 2 * M_PI, b = (uniform(rng) - 0.5) * 0.5;
+        double XR[9] = {cos(a), -sin(a) * cos(b), sin(a) * sin(b), sin(a), cos(a) * cos(b), -cos(a) * sin(b), 0, sin(b), cos(b)};
+        double XT[3] = {uniform(rng) - 0.5, uniform(rng) - 0.5, uniform(rng) + 1};
+        Reprojection reprojection;
+        reprojection.init(Q, s % 4 ? XR : 0, s % 4 ? XT : 0, width, height);
+
+        // dense points in double for the limits
+        size_t plane = (size_t)width * height;
+        std::vector<double> xyz(3 * plane);
+        reprojection.reprojectRows(D.data(), D_step, xyz.data(), 0, height, Reprojection::XYZ_F64);
+
+        // limits: everything with a disparity, or random ranges around the points and a random smallest disparity
+        Reprojection::Limits limits;
+        if (s % 2) {
+            limits.d_min = 1 + (int32_t)(uniform(rng) * 64);
+            for (int32_t k = 0; k < 3; k++) {
+                double c = xyz[3 * (plane / 2) + k], r = 0.5 + 20 * uniform(rng);
+                if (!isfinite(c))
+                    c = 0;
+                limits.min[k] = uniform(rng) < 0.2 ? -INFINITY : c - r;
+                limits.max[k] = uniform(rng) < 0.2 ? INFINITY : c + r;
+            }
+        }
+
+        for (int32_t f_index = 0; f_index < 4; f_index++) {
+            Reprojection::Format format = (Reprojection::Format)f_index;
+            int32_t size = Reprojection::pointSize(format);
+            std::vector<uint8_t> dense(plane * size), points(plane * size);
+            reprojection.reprojectRows(D.data(), D_step, dense.data(), 0, height, format);
+
+            // expected: the dense points inside the limits, and how many of them every row has
+            std::vector<uint8_t> expected;
+            std::vector<int32_t> row_counts(height, 0);
+            for (int32_t v = 0; v < height; v++) {
+                for (int32_t u = 0; u < width; u++) {
+                    size_t i = (size_t)v * width + u;
+                    const double *p = xyz.data() + 3 * i;
+                    if (D[v * D_step + u] >= limits.d_min && p[0] > limits.min[0] && p[0] < limits.max[0] && p[1] > limits.min[1] &&
+                        p[1] < limits.max[1] && p[2] > limits.min[2] && p[2] < limits.max[2]) {
+                        expected.resize(expected.size() + size);
+                        pointBytes(dense.data(), i, plane, format, expected.data() + expected.size() - size);
+                        row_counts[v]++;
+                    }
+                }
+            }
+            size_t n_expected = expected.size() / size;
+
+            // all rows at once
+            size_t n = reprojection.reprojectRowsCompact(D.data(), D_step, points.data(), 0, height, limits, format, true);
+            bool ok = n == n_expected && samePoints(points.data(), plane, format, 0, expected, 0, n);
+
+            // one row per call, then packRows
+            std::vector<int32_t> counts(height);
+            for (int32_t v = 0; v < height; v++)
+                counts[v] = reprojection.reprojectRowsCompact(D.data(), D_step, points.data(), v, v + 1, limits, format);
+            n = reprojection.packRows(points.data(), counts.data(), format);
+            ok = ok && counts == row_counts && n == n_expected && samePoints(points.data(), plane, format, 0, expected, 0, n);
+
+            // random row ranges, each written from its first row on
+            size_t n_first = 0;
+            for (int32_t v_min = 0; ok && v_min < height;) {
+                int32_t v_max = std::min(height, v_min + 1 + (int32_t)(uniform(rng) * 8));
+                size_t n_range = 0;
+                for (int32_t v = v_min; v < v_max; v++)
+                    n_range += row_counts[v];
+                n = reprojection.reprojectRowsCompact(D.data(), D_step, points.data(), v_min, v_max, limits, format);
+                ok = n == n_range && samePoints(points.data(), plane, format, (size_t)v_min * width, expected, n_first, n);
+                n_first += n_range;
+                v_min = v_max;
+            }
+
+            checks++;
+            if (!ok) {
+                failures++;
+                printf("image %d (%dx%d), %s: the compact points differ from the filtered dense ones\n", s, width, height, format_names[format]);
+            }
+        }
+    }
+    printf("%d compact reprojections, %d differ from the filtered dense output\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+// Check of the speckle removal of libelas (Elas::removeSmallSegments, the union-find labeler of
+// labelSegments, joinSegments and invalidateSmallSegments) against the column-major flood fill it
+// replaced: both must invalidate exactly the same pixels. The inputs are the left and right disparity
+// maps of datasets/profile (with and without subsampling) and random maps of piecewise planar
+// disparities with noise and holes (-10, as left by the L/R consistency check), each for several
+// speckle sizes and similarity thresholds.
+//
+// build: make segments_test serial=1   (or omp=1)
+// run:   ./build/bin/segments_test [repository root]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/common_includes/image.h"
+#include "elas.h"
+
+// the internal steps of Elas checked here
+struct ElasTest {
+    static void removeSmallSegments(Elas &elas, float *D, bool right_image) {
+#ifdef _OPENMP
+#pragma omp parallel
+#pragma omp single
+        elas.removeSmallSegments(D, right_image);
+#else
+        elas.removeSmallSegments(D);
+#endif
+    }
+    static Elas::parameters &param(Elas &elas) { return elas.param; }
+};
+
+// Elas::removeSmallSegments() before the union-find labeler
+static void removeSmallSegmentsLibelas(float *D, int32_t D_width, int32_t D_height, float speckle_sim_threshold, int32_t D_speckle_size) {
+    std::vector<int32_t> D_done(D_width * D_height, 0), seg_list_u(D_width * D_height), seg_list_v(D_width * D_height);
+    for (int32_t u = 0; u < D_width; u++) {
+        for (int32_t v = 0; v < D_height; v++) {
+            if (D_done[v * D_width + u])
+                continue;
+            seg_list_u[0] = u;
+            seg_list_v[0] = v;
+            int32_t seg_list_count = 1;
+            for (int32_t seg_list_curr = 0; seg_list_curr < seg_list_count; seg_list_curr++) {
+                int32_t u_seg_curr = seg_list_u[seg_list_curr], v_seg_curr = seg_list_v[seg_list_curr];
+                int32_t addr_curr = v_seg_curr * D_width + u_seg_curr;
+                const int32_t u_neighbor[4] = {u_seg_curr - 1, u_seg_curr + 1, u_seg_curr, u_seg_curr};
+                const int32_t v_neighbor[4] = {v_seg_curr, v_seg_curr, v_seg_curr - 1, v_seg_curr + 1};
+                for (int32_t i = 0; i < 4; i++) {
+                    if (u_neighbor[i] < 0 || v_neighbor[i] < 0 || u_neighbor[i] >= D_width || v_neighbor[i] >= D_height)
+                        continue;
+                    int32_t addr_neighbor = v_neighbor[i] * D_width + u_neighbor[i];
+                    if (D_done[addr_neighbor] == 0 && D[addr_neighbor] >= 0 && fabs(D[addr_curr] - D[addr_neighbor]) <= speckle_sim_threshold) {
+                        seg_list_u[seg_list_count] = u_neighbor[i];
+                        seg_list_v[seg_list_count] = v_neighbor[i];
+                        seg_list_count++;
+                        D_done[addr_neighbor] = 1;
+                    }
+                }
+                D_done[addr_curr] = 1;
+            }
+            if (seg_list_count < D_speckle_size)
+                for (int32_t i = 0; i < seg_list_count; i++)
+                    D[seg_list_v[i] * D_width + seg_list_u[i]] = -10;
+        }
+    }
+}
+
+// planes with noise in random rectangles, a share of the pixels invalid (-10 is the only negative
+// value the speckle removal gets, a flood fill started from a pixel in -speckle_sim_threshold..0 would
+// join valid neighbors)
+static void randomDisparities(std::mt19937 &rng, float *D, int32_t D_width, int32_t D_height) {
+    std::uniform_real_distribution<float> uniform(0, 1);
+    for (int32_t i = 0; i < D_width * D_height; i++)
+        D[i] = -10;
+    for (int32_t r = 0; r < 200; r++) {
+        int32_t u0 = uniform(rng) * D_width, v0 = uniform(rng) * D_height;
+        int32_t u1 = std::min(D_width, u0 + 1 + (int32_t)(uniform(rng) * D_width / 4));
+        int32_t v1 = std::min(D_height, v0 + 1 + (int32_t)(uniform(rng) * D_height / 4));
+        float d = uniform(rng) * 100, du = uniform(rng) * 0.2f - 0.1f, dv = uniform(rng) * 0.2f - 0.1f, noise = uniform(rng) * 2;
+        for (int32_t v = v0; v < v1; v++)
+            for (int32_t u = u0; u < u1; u++)
+                D[v * D_width + u] = uniform(rng) < 0.05f ? -10 : fmaxf(roundf(4 * (d + du * (u - u0) + dv * (v - v0) + noise * uniform(rng))) / 4, 0);
+    }
+}
+
+int main(int argc, char **argv) {
+    std::string root = argc > 1 ? argv[1] : ".";
+    const char *names[] = {"cones", "aloe", "raindeer", "urban1", "urban2", "urban3", "urban4"};
+    std::mt19937 rng(1);
+    int32_t checks = 0, failures = 0;
+    for (int32_t subsampling = 0; subsampling < 2; subsampling++) {
+        for (const char *name : names) {
+            std::string prefix = root + "/datasets/profile/" + name;
+            image<uchar> *I1 = loadPGM((prefix + "_left.pgm").c_str());
+            image<uchar> *I2 = loadPGM((prefix + "_right.pgm").c_str());
+            int32_t width = I1->width(), height = I1->height();
+            const int32_t dims[3] = {width, height, width};
+            int32_t D_width = subsampling ? width / 2 : width, D_height = subsampling ? height / 2 : height;
+            std::vector<float> D1(D_width * D_height), D2(D_width * D_height);
+
+            Elas::parameters param;
+            param.subsampling = subsampling;
+            param.postprocess_only_left = false;
+            Elas elas(param);
+            elas.process(I1->data, I2->data, D1.data(), D2.data(), dims);
+
+            std::vector<float> maps[3] = {D1, D2, std::vector<float>(D_width * D_height)};
+            randomDisparities(rng, maps[2].data(), D_width, D_height);
+            for (int32_t m = 0; m < 3; m++) {
+                for (int32_t speckle_size : {20, 200, 1000}) {
+                    for (float speckle_sim_threshold : {0.5f, 1.0f, 2.0f}) {
+                        ElasTest::param(elas).speckle_size = speckle_size;
+                        ElasTest::param(elas).speckle_sim_threshold = speckle_sim_threshold;
+                        int32_t D_speckle_size = subsampling ? sqrt((float)speckle_size) * 2 : speckle_size;
+                        std::vector<float> D_reference = maps[m], D = maps[m];
+                        removeSmallSegmentsLibelas(D_reference.data(), D_width, D_height, speckle_sim_threshold, D_speckle_size);
+                        ElasTest::removeSmallSegments(elas, D.data(), m == 1);
+                        checks++;
+                        if (memcmp(D.data(), D_reference.data(), D.size() * sizeof(float))) {
+                            failures++;
+                            printf("%s %s%s, speckle size %d, threshold %.1f: the invalidated pixels differ\n", name, m == 2 ? "random" : m ? "right" : "left",
+                                   subsampling ? " (subsampling)" : "", speckle_size, speckle_sim_threshold);
+                        }
+                    }
+                }
+            }
+            delete I1;
+            delete I2;
+        }
+    }
+    printf("%d speckle removals, %d differ from the flood fill\n", checks, failures);
+    return failures ? 1 : 0;
+}